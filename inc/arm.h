@@ -5,6 +5,53 @@ static inline void load_pgdir(uint32_t value) {
 	asm volatile ("mcr p15, 0, %0, c2, c0, 0" : : "r"(value));
 }
 
+// The kernel half of the address space; see USERTOP.
+static inline void load_kern_pgdir(uint32_t value) {
+	asm volatile ("mcr p15, 0, %0, c2, c0, 1" : : "r"(value));
+}
+
+static inline void write_ttbcr(uint32_t value)
+{
+	asm volatile("mcr p15, 0, %0, c2, c0, 2" : : "r" (value));
+}
+
+// ASID of the running address space, in bits 7:0.
+static inline void write_contextidr(uint32_t value)
+{
+	asm volatile("mcr p15, 0, %0, c13, c0, 1" : : "r" (value) : "memory");
+}
+
+// Domain access control: two bits per domain.
+static inline uint32_t read_dacr(void)
+{
+	uint32_t val;
+	asm volatile("mrc p15, 0, %0, c3, c0, 0" : "=r" (val));
+	return val;
+}
+
+static inline void write_dacr(uint32_t val)
+{
+	asm volatile("mcr p15, 0, %0, c3, c0, 0" : : "r" (val) : "memory");
+}
+
+// TLB maintenance: one page (MVA in bits 31:12, ASID in bits 7:0),
+// every non-global entry of one ASID, or the whole TLB.  The caller
+// issues the barriers.
+static inline void tlbimva(uint32_t mva_asid)
+{
+	asm volatile("mcr p15, 0, %0, c8, c7, 1" : : "r" (mva_asid) : "memory");
+}
+
+static inline void tlbiasid(uint32_t asid)
+{
+	asm volatile("mcr p15, 0, %0, c8, c7, 2" : : "r" (asid) : "memory");
+}
+
+static inline void tlbiall(void)
+{
+	asm volatile("mcr p15, 0, %0, c8, c7, 0" : : "r" (0) : "memory");
+}
+
 static inline uint32_t read_r11(void)
 {
 	uint32_t r11;
@@ -12,4 +59,100 @@ static inline uint32_t read_r11(void)
 	return r11;
 }
 
+static inline uint32_t read_cpsr(void)
+{
+	uint32_t val;
+	asm volatile("mrs %0, cpsr" : "=r" (val));
+	return val;
+}
+
+static inline void intr_enable(void)
+{
+	asm volatile("cpsie i" : : : "memory");
+}
+
+static inline void intr_disable(void)
+{
+	asm volatile("cpsid i" : : : "memory");
+}
+
+// Mask IRQs, returning the CPSR to hand back to intr_restore().
+static inline uint32_t intr_save(void)
+{
+	uint32_t cpsr = read_cpsr();
+	intr_disable();
+	return cpsr;
+}
+
+// Unmask IRQs again if they were unmasked (CPSR.I, bit 7, clear).
+static inline void intr_restore(uint32_t cpsr)
+{
+	if (!(cpsr & (1 << 7)))
+		intr_enable();
+}
+
+// Exception vector base; needs the ARMv6 security extensions.
+static inline void write_vbar(uint32_t val)
+{
+	asm volatile("mcr p15, 0, %0, c12, c0, 0" : : "r" (val) : "memory");
+}
+
+// Fault status and address registers.
+static inline uint32_t read_dfsr(void)
+{
+	uint32_t val;
+	asm volatile("mrc p15, 0, %0, c5, c0, 0" : "=r" (val));
+	return val;
+}
+
+static inline uint32_t read_dfar(void)
+{
+	uint32_t val;
+	asm volatile("mrc p15, 0, %0, c6, c0, 0" : "=r" (val));
+	return val;
+}
+
+static inline uint32_t read_ifsr(void)
+{
+	uint32_t val;
+	asm volatile("mrc p15, 0, %0, c5, c0, 1" : "=r" (val));
+	return val;
+}
+
+static inline uint32_t read_ifar(void)
+{
+	uint32_t val;
+	asm volatile("mrc p15, 0, %0, c6, c0, 2" : "=r" (val));
+	return val;
+}
+
+static inline uint32_t read_sctlr(void)
+{
+	uint32_t val;
+	asm volatile("mrc p15, 0, %0, c1, c0, 0" : "=r" (val));
+	return val;
+}
+
+static inline void write_sctlr(uint32_t val)
+{
+	asm volatile("mcr p15, 0, %0, c1, c0, 0" : : "r" (val) : "memory");
+}
+
+// Barriers.  These are the ARMv6 CP15 encodings; ARMv7 cores still
+// accept them, so the same kernel runs on both.
+static inline void dsb(void)
+{
+	asm volatile("mcr p15, 0, %0, c7, c10, 4" : : "r" (0) : "memory");
+}
+
+static inline void dmb(void)
+{
+	asm volatile("mcr p15, 0, %0, c7, c10, 5" : : "r" (0) : "memory");
+}
+
+static inline void isb(void)
+{
+	asm volatile("mcr p15, 0, %0, c7, c5, 4" : : "r" (0) : "memory");
+}
+
 #endif
@@ -25,7 +25,7 @@
  *                     |                              | RW/--
  *                     |   Remapped Physical Memory   | RW/--
  *                     |                              | RW/--
- *    KERNBASE, ---->  +------------------------------+ 0xf0000000      --+
+ *    KERNBASE, ---->  +------------------------------+ 0xc0000000      --+
  *    KSTACKTOP        |     CPU0's Kernel Stack      | RW/--  KSTKSIZE   |
  *                     | - - - - - - - - - - - - - - -|                   |
  *                     |      Invalid Memory (*)      | --/--  KSTKGAP    |
@@ -36,21 +36,27 @@
  *                     +------------------------------+                   |
  *                     :              .               :                   |
  *                     :              .               :                   |
- *    MMIOLIM ------>  +------------------------------+ 0xefc00000      --+
- *                     |       Memory-mapped I/O      | RW/--  PTSIZE
- * ULIM, MMIOBASE -->  +------------------------------+ 0xef800000
+ *    MMIOLIM ------>  +------------------------------+ 0xbff00000      --+
+ *                     |  Memory-mapped I/O (periph)  | RW/--  PTSIZE
+ *    MMIOBASE ----->  +------------------------------+ 0xbfe00000
+ *                     |   Memory-mapped I/O (GPIO)   | RW/--  PTSIZE
+ * ULIM, GPIOBASE -->  +------------------------------+ 0xbfd00000
  *                     |  Cur. Page Table (User R-)   | R-/R-  PTSIZE
- *    UVPT      ---->  +------------------------------+ show
+ *    UVPT      ---->  +------------------------------+ 0xbfc00000
  *                     |          RO PAGES            | R-/R-  PTSIZE
- *    UPAGES    ---->  +------------------------------+ 0xef000000
+ *    UPAGES    ---->  +------------------------------+ 0xbfb00000
  *                     |           RO ENVS            | R-/R-  PTSIZE
- * UTOP,UENVS ------>  +------------------------------+ 0xeec00000
+ *    UENVS     ---->  +------------------------------+ 0xbfa00000
+ *                     :              .               :
+ *                     :      Invalid Memory (*)      : --/--
+ *                     :              .               :
+ * USERTOP, UTOP --->  +------------------------------+ 0x80000000
  * UXSTACKTOP -/       |     User Exception Stack     | RW/RW  PGSIZE
- *                     +------------------------------+ 0xeebff000
+ *                     +------------------------------+ 0x7ffff000
  *                     |       Empty Memory (*)       | --/--  PGSIZE
- *    USTACKTOP  --->  +------------------------------+ 0xeebfe000
+ *    USTACKTOP  --->  +------------------------------+ 0x7fffe000
  *                     |      Normal User Stack       | RW/RW  PGSIZE
- *                     +------------------------------+ 0xeebfd000
+ *                     +------------------------------+ 0x7fffd000
  *                     |                              |
  *                     |                              |
  *                     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -73,24 +79,41 @@
  * (*) Note: The kernel ensures that "Invalid Memory" is *never* mapped.
  *     "Empty Memory" is normally unmapped, but user programs may map pages
  *     there if desired.  JOS user programs map pages temporarily at UTEMP.
+ *
+ * The MMU splits the map at USERTOP (TTBCR.N = 1).  Addresses below it
+ * are translated by the current address space's page directory in
+ * TTBR0, which has only the NUPDENTRIES entries for that half; those at
+ * or above it by kern_pgdir in TTBR1, which is shared by everyone and
+ * holds only global mappings.
  */
 
 
-// All physical memory mapped at this address
-#define	KERNBASE	0xF0000000
+// All physical memory mapped at this address.  This leaves a 1GB window,
+// enough for all the RAM of a Raspberry Pi 2.
+#define	KERNBASE	0xC0000000
+
+// Physical memory that entry_pgdir maps at KERNBASE, i.e. all that can
+// be touched before mem_init() switches to kern_pgdir.
+#define EARLYMEM	(16 * 1024 * 1024)
 
 // Kernel stack.
 #define KSTACKTOP	KERNBASE
 #define KSTKSIZE	(8*PGSIZE)   		// size of a kernel stack
 #define KSTKGAP		(8*PGSIZE)   		// size of a kernel stack guard
 
-// Memory-mapped IO.
+// Memory-mapped IO.  MMIOBASE maps the first megabyte of the BCM2835
+// peripherals (physical 0x3F000000: system timer, interrupt controller);
+// GPIOBASE maps the GPIO and UART megabyte at physical 0x3F200000.
 #define MMIOLIM		(KSTACKTOP - PTSIZE)
 #define MMIOBASE	(MMIOLIM - PTSIZE)
 #define GPIOBASE	(MMIOBASE - PTSIZE)
 
 #define ULIM		(GPIOBASE)
 
+// Boundary between the TTBR0 (per address space) and TTBR1 (kernel)
+// halves of the address space.
+#define USERTOP		0x80000000
+
 /*
  * User read-only mappings! Anything below here til UTOP are readonly to user.
  * They are global pages mapped in at env allocation time.
@@ -108,7 +131,7 @@
  */
 
 // Top of user-accessible VM
-#define UTOP		UENVS
+#define UTOP		USERTOP
 // Top of one-page user exception stack
 #define UXSTACKTOP	UTOP
 // Next page left invalid to guard against exception stack overflow; then:
@@ -161,8 +184,22 @@ extern volatile pde_t uvpd[];     // VA of current page directory
  * with page2pa() in kern/pmap.h.
  */
 struct PageInfo {
-	// Next page on the free list.
-	struct PageInfo *pp_link;
+	union {
+		struct {
+			// Next page on the free list.
+			struct PageInfo *pp_link;
+			// Previous block on the same buddy free list, so
+			// that a free block can be unlinked in O(1) when it
+			// merges with its buddy.
+			struct PageInfo *pp_prev;
+		};
+		// For a page holding L2 page tables (PP_PGTBL): the
+		// number of valid entries in each of its four 1KB tables.
+		uint16_t pp_ptecnt[4];
+		// For the first page of a user page directory (PP_PGDIR):
+		// the ASID generation and ASID it last ran with.
+		uint32_t pp_asid;
+	};
 
 	// pp_ref is the count of pointers (usually in page table entries)
 	// to this page, for pages allocated using page_alloc.
@@ -170,6 +207,11 @@ struct PageInfo {
 	// boot_alloc do not have valid reference count fields.
 
 	uint16_t pp_ref;
+
+	// For the first page of a free block: log2 of the block's size
+	// in pages.  See the buddy allocator in kern/pmap.c.
+	uint8_t pp_order;
+	uint8_t pp_flags;	// PP_* flags from kern/pmap.h
 };
 
 #endif /* !__ASSEMBLER__ */
@@ -45,6 +45,9 @@
 #define PTSIZE		(PGSIZE*NPTENTRIES) // bytes mapped by a page directory entry
 #define PTSHIFT		20		// log2(PTSIZE)
 
+#define LPGSIZE		(16*PGSIZE)	// bytes mapped by a large page
+#define SUPSIZE		(16*PTSIZE)	// bytes mapped by a supersection
+
 #define PTXSHIFT	12		// offset of PTX in a linear address
 #define PDXSHIFT	20		// offset of PDX in a linear address
 
@@ -64,19 +67,78 @@
 
 #define PDE_P (0x3)
 
+// Memory attributes of section entries (TEX = 0): C and B together
+// select outer and inner write-back.  Device memory must stay uncached.
+#define PDE_B (1 << 2)
+#define PDE_C (1 << 3)
+#define PDE_CACHED (PDE_C | PDE_B)
+
+#define PDE_XN (1 << 4)
+#define PDE_S (1 << 16)
+#define PDE_NG (1 << 17)
+#define PDE_SUPER (1 << 18)	// a section entry that maps 16MB
+
 #define PTE_APX (1 << 9)
 #define PTE_NONE_ALL 0
 #define PTE_NONE_U (1 << 4)
 #define PTE_R_U (2 << 4)
 #define PTE_RW_U (3 << 4)
+// Copy-on-write: user read/write, but held read-only by APX until the
+// first store.  Plain read-only mappings are PTE_APX | PTE_R_U, so
+// APX together with AP=11 only ever means copy-on-write.
+#define PTE_COW (PTE_APX | PTE_RW_U)
 #define PTE_ENTRY_SMALL (0x2)
 #define PTE_ENTRY_LARGE (0x1)
 
 #define PTE_P (0x3)
 
+#define PTE_B (1 << 2)
+#define PTE_C (1 << 3)
+#define PTE_CACHED (PTE_C | PTE_B)
+
+// Small page layout; large pages keep TEX in bits 14:12 and XN in 15.
+#define PTE_XN (1 << 0)
+#define PTE_TEX(t) ((t) << 6)
+#define PTE_S (1 << 10)
+#define PTE_NG (1 << 11)
+#define PTE_LARGE_XN (1 << 15)
+
 
 #define DOMAIN_NONE 0x0
 #define DOMAIN_CLIENT 0x1
 #define DOMAIN_MANAGER 0x3
 
+// System control register (CP15 c1) bits.
+#define SCTLR_M (1 << 0)	// MMU enable
+#define SCTLR_C (1 << 2)	// data cache enable
+#define SCTLR_Z (1 << 11)	// branch prediction enable
+#define SCTLR_I (1 << 12)	// instruction cache enable
+#define SCTLR_V (1 << 13)	// high exception vectors (0xFFFF0000)
+#define SCTLR_XP (1 << 23)	// ARMv6 extended page tables (APX, nG, XN)
+
+// TTBCR.N: TTBR0 translates VAs below 2^(32-N).
+#define TTBCR_N(n) (n)
+
+// Fault status registers (DFSR, IFSR).  The status code is split
+// between bits 10 and 3:0.
+#define FSR_FS(fsr) ((((fsr) >> 6) & 0x10) | ((fsr) & 0xF))
+#define FSR_DOMAIN(fsr) (((fsr) >> 4) & 0xF)
+#define FSR_WNR (1 << 11)	// DFSR: the access was a write
+
+#define FS_ALIGN 0x01		// alignment
+#define FS_DEBUG 0x02		// debug event
+#define FS_ACCESS_SEC 0x03	// access flag, section
+#define FS_ICACHE 0x04		// instruction cache maintenance
+#define FS_TRANS_SEC 0x05	// translation, section
+#define FS_ACCESS_PAGE 0x06	// access flag, page
+#define FS_TRANS_PAGE 0x07	// translation, page
+#define FS_EXT 0x08		// precise external abort
+#define FS_DOMAIN_SEC 0x09	// domain, section
+#define FS_DOMAIN_PAGE 0x0B	// domain, page
+#define FS_WALK_L1 0x0C		// external abort on L1 table walk
+#define FS_PERM_SEC 0x0D	// permission, section
+#define FS_WALK_L2 0x0E		// external abort on L2 table walk
+#define FS_PERM_PAGE 0x0F	// permission, page
+#define FS_IMPRECISE 0x16	// imprecise external abort
+
 #endif
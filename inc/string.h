@@ -20,6 +20,18 @@ void *	memmove(void *dst, const void *src, size_t len);
 int	memcmp(const void *s1, const void *s2, size_t len);
 void *	memfind(const void *s, int c, size_t len);
 
+// Byte-at-a-time reference versions of the optimized routines.
+int	strlen_bytes(const char *s);
+int	strcmp_bytes(const char *s1, const char *s2);
+char *	strfind_bytes(const char *s, char c);
+int	memcmp_bytes(const void *s1, const void *s2, size_t len);
+void *	memset_bytes(void *dst, int c, size_t len);
+void *	memmove_bytes(void *dst, const void *src, size_t len);
+
+// lib/memfunc.S: whole pages, which must be page aligned.
+void	page_zero(void *pg);
+void	page_copy(void *dst, const void *src);
+
 long	strtol(const char *s, char **endptr, int base);
 
 #endif /* not JOS_INC_STRING_H */
@@ -0,0 +1,55 @@
+#ifndef JOS_INC_TRAP_H
+#define JOS_INC_TRAP_H
+
+// Trap numbers: the exception vectors, in vector table order.
+#define T_RESET		0	// reset (never taken through VBAR)
+#define T_UNDEF		1	// undefined instruction
+#define T_SVC		2	// supervisor call
+#define T_PABT		3	// prefetch abort
+#define T_DABT		4	// data abort
+#define T_UNUSED	5	// reserved vector
+#define T_IRQ		6	// interrupt request
+#define T_FIQ		7	// fast interrupt request
+
+// Processor modes and flags in the CPSR/SPSR.
+#define PSR_MODE_MASK	0x1F
+#define PSR_USR		0x10
+#define PSR_FIQ		0x11
+#define PSR_IRQ		0x12
+#define PSR_SVC		0x13
+#define PSR_ABT		0x17
+#define PSR_UND		0x1B
+#define PSR_SYS		0x1F
+#define PSR_T		(1 << 5)	// Thumb state
+#define PSR_F		(1 << 6)	// FIQs masked
+#define PSR_I		(1 << 7)	// IRQs masked
+#define PSR_A		(1 << 8)	// imprecise aborts masked
+
+// Offsets into struct Trapframe, for kern/trapentry.S.
+#define TF_TRAPNO	0
+#define TF_R0		4
+#define TF_SP		56
+#define TF_LR		60
+#define TF_PC		64
+#define TF_SPSR		68
+#define TF_SIZE		72
+
+#ifndef __ASSEMBLER__
+
+#include <inc/types.h>
+
+// Saved by kern/trapentry.S on the stack of the mode the exception
+// was taken to.  tf_pc and tf_spsr are adjacent so that the return
+// path can restore both with one RFE.
+struct Trapframe {
+	uint32_t tf_trapno;
+	uint32_t tf_r[13];	// r0-r12
+	uint32_t tf_sp;		// sp of the interrupted mode
+	uint32_t tf_lr;		// lr of the interrupted mode
+	uint32_t tf_pc;		// where to resume
+	uint32_t tf_spsr;	// CPSR of the interrupted code
+};
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_INC_TRAP_H */
@@ -0,0 +1,558 @@
+// Kernel microbenchmarks, run from the monitor with "bench <name>".
+//
+// Most time one operation with bench_time(), which runs it in batches
+// long enough for the clock to resolve and prints the minimum, median
+// and 99th percentile over the batches, per operation, in cycles and
+// nanoseconds.  The batch sizes, warmup and sample counts are fixed,
+// so that numbers from different builds compare.
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/mmu.h>
+
+#include <kern/bench.h>
+#include <kern/monitor.h>
+#include <kern/pmap.h>
+#include <kern/time.h>
+#include <kern/kdebug.h>
+
+#define BENCH_NSAMPLE	200	// timed batches per operation
+#define BENCH_WARMUP	8	// untimed batches before them
+#define BENCH_BATCH_NS	(200 * NSEC_PER_USEC)	// shortest batch
+#define BENCH_MAXBATCH	(1 << 16)	// operations per batch, at most
+
+static uint32_t bench_cycles[BENCH_NSAMPLE];
+static uint32_t bench_ns[BENCH_NSAMPLE];
+
+static void
+bench_sort(uint32_t *v, int n)
+{
+	uint32_t x;
+	int i, j;
+
+	for (i = 1; i < n; i++) {
+		x = v[i];
+		for (j = i; j > 0 && v[j - 1] > x; j--)
+			v[j] = v[j - 1];
+		v[j] = x;
+	}
+}
+
+static void
+bench_header(void)
+{
+	cprintf("  %-18s %26s %26s\n", "", "cycles/op", "ns/op");
+	cprintf("  %-18s %8s %8s %8s %8s %8s %8s\n", "operation",
+		"min", "median", "p99", "min", "median", "p99");
+	if (pmu_model == PMU_NONE)
+		cprintf("  (no cycle counter: cycles are clock ticks)\n");
+}
+
+// Time op(arg), which must leave things as it found them, and print
+// one line for it.  The batch size is the smallest power of two that
+// takes BENCH_BATCH_NS; finding it warms the caches up, and
+// BENCH_WARMUP more batches follow before the timed ones.  The times
+// include the indirect call.
+static void
+bench_time(const char *label, void (*op)(void *), void *arg)
+{
+	uint64_t t0;
+	uint32_t c0, n;
+	int i, s;
+
+	for (n = 1; n < BENCH_MAXBATCH; n *= 2) {
+		t0 = time_ns();
+		for (i = 0; i < n; i++)
+			op(arg);
+		if (time_ns() - t0 >= BENCH_BATCH_NS)
+			break;
+	}
+	for (s = -BENCH_WARMUP; s < BENCH_NSAMPLE; s++) {
+		t0 = time_ns();
+		c0 = cycles();
+		for (i = 0; i < n; i++)
+			op(arg);
+		if (s < 0)
+			continue;
+		bench_cycles[s] = (cycles() - c0) / n;
+		bench_ns[s] = (time_ns() - t0) / n;
+	}
+
+	bench_sort(bench_cycles, BENCH_NSAMPLE);
+	bench_sort(bench_ns, BENCH_NSAMPLE);
+	cprintf("  %-18s %8u %8u %8u %8u %8u %8u\n", label,
+		bench_cycles[0], bench_cycles[BENCH_NSAMPLE / 2],
+		bench_cycles[BENCH_NSAMPLE * 99 / 100],
+		bench_ns[0], bench_ns[BENCH_NSAMPLE / 2],
+		bench_ns[BENCH_NSAMPLE * 99 / 100]);
+}
+
+// Values for formatting benchmarks: a linear congruential sequence,
+// so that every digit count turns up.
+static inline uint32_t
+bench_next(uint32_t v)
+{
+	return v * 1103515245 + 12345;
+}
+
+struct FmtArg {
+	const char *fa_fmt;
+	uint32_t fa_val;
+};
+
+static void
+op_snprintf(void *arg)
+{
+	struct FmtArg *fa = arg;
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), fa->fa_fmt, fa->fa_val, "bench", fa->fa_val);
+	fa->fa_val = bench_next(fa->fa_val);
+}
+
+static void
+bench_printfmt(void)
+{
+	static const char * const fmts[] = {
+		"%d", "%x", "%08x", "%u %s %08x",
+	};
+	struct FmtArg fa;
+	int f;
+
+	bench_header();
+	for (f = 0; f < sizeof(fmts) / sizeof(fmts[0]); f++) {
+		fa.fa_fmt = fmts[f];
+		fa.fa_val = 1;
+		bench_time(fmts[f], op_snprintf, &fa);
+	}
+}
+
+// MB/s for 'bytes' moved in 'ns'.
+static uint32_t
+bench_mbps(uint64_t bytes, uint64_t ns)
+{
+	return ns ? bytes * 1000 / ns : 0;
+}
+
+typedef void *(*setfn_t)(void *, int, size_t);
+typedef void *(*movefn_t)(void *, const void *, size_t);
+
+static uint32_t
+bench_set(setfn_t fn, void *dst, size_t size, int iters)
+{
+	uint64_t t0 = time_ns();
+	int i;
+
+	for (i = 0; i < iters; i++)
+		fn(dst, i, size);
+	return bench_mbps((uint64_t) size * iters, time_ns() - t0);
+}
+
+static uint32_t
+bench_move(movefn_t fn, void *dst, const void *src, size_t size, int iters)
+{
+	uint64_t t0 = time_ns();
+	int i;
+
+	for (i = 0; i < iters; i++)
+		fn(dst, src, size);
+	return bench_mbps((uint64_t) size * iters, time_ns() - t0);
+}
+
+// Compare the ARM versions with the byte versions for every small
+// length at every relative alignment, overlapping both ways.
+static int
+bench_memfunc_check(char *a, char *b, char *src)
+{
+	int bad = 0, d, s, n, i;
+
+	for (i = 0; i < 256; i++)
+		src[i] = i * 7 + 1;
+	for (d = 0; d < 4; d++)
+		for (s = 0; s < 4; s++)
+			for (n = 0; n < 100; n++) {
+				memset_bytes(a, 0, 256);
+				memset_bytes(b, 0, 256);
+				memcpy(a + d, src + s, n);
+				memmove_bytes(b + d, src + s, n);
+				bad += memcmp(a, b, 256) != 0;
+
+				memset(a + d, n, n);
+				memset_bytes(b + d, n, n);
+				bad += memcmp(a, b, 256) != 0;
+
+				memmove(a + d + s, a + d, n);
+				memmove_bytes(b + d + s, b + d, n);
+				bad += memcmp(a, b, 256) != 0;
+				memmove(a + d, a + d + s + 1, n);
+				memmove_bytes(b + d, b + d + s + 1, n);
+				bad += memcmp(a, b, 256) != 0;
+			}
+	return bad;
+}
+
+#define MEMFUNC_BYTES	(1 << 21)	// moved per measurement
+
+static void
+bench_memfunc(void)
+{
+	static const size_t sizes[] = {
+		1, 16, 64, 256, 1024, 4096, 65536, 1 << 20,
+	};
+	struct PageInfo *dpp, *spp;
+	uint64_t t0;
+	char *dst, *src;
+	size_t size;
+	int i, j, iters;
+
+	// 1MB each, enough for the largest size.
+	dpp = page_alloc_order(8, 0);
+	spp = page_alloc_order(8, 0);
+	if (!dpp || !spp) {
+		cprintf("  out of memory\n");
+		goto out;
+	}
+	dst = page2kva(dpp);
+	src = page2kva(spp);
+
+	cprintf("  %d mismatches against the byte versions\n",
+		bench_memfunc_check(dst, dst + 512, src));
+
+	cprintf("  MB/s      size  memset_bytes  memset  memmove_bytes  memcpy\n");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		size = sizes[i];
+		iters = MAX(MEMFUNC_BYTES / size, 4);
+		cprintf("  %14u  %12u  %6u  %13u  %6u\n", size,
+			bench_set(memset_bytes, dst, size, iters),
+			bench_set(memset, dst, size, iters),
+			bench_move(memmove_bytes, dst, src, size, iters),
+			bench_move(memcpy, dst, src, size, iters));
+	}
+
+	iters = MEMFUNC_BYTES / PGSIZE;
+	t0 = time_ns();
+	for (j = 0; j < iters; j++)
+		page_zero(dst);
+	cprintf("  page_zero %u MB/s", bench_mbps(MEMFUNC_BYTES, time_ns() - t0));
+	t0 = time_ns();
+	for (j = 0; j < iters; j++)
+		page_copy(dst, src);
+	cprintf(", page_copy %u MB/s\n", bench_mbps(MEMFUNC_BYTES, time_ns() - t0));
+
+out:
+	if (dpp)
+		page_free_order(dpp, 8);
+	if (spp)
+		page_free_order(spp, 8);
+}
+
+static int
+sign(int x)
+{
+	return (x > 0) - (x < 0);
+}
+
+// Compare the word-at-a-time string routines with the byte versions
+// for every string length up to 40 at every alignment of both
+// operands, with the strings differing at every position (or not at
+// all), and for every character strfind and strchr can look for.
+static int
+bench_string_check(void)
+{
+	static char a[64], b[64];
+	int bad = 0, da, db, len, pos, i, c;
+	char *x, *y, *e;
+	size_t k;
+
+	for (da = 0; da < 8; da++)
+		for (db = 0; db < 8; db++)
+			for (len = 0; len < 40; len++)
+				for (pos = -1; pos <= len; pos++) {
+					memset(a, 0x81, sizeof(a));
+					memset(b, 0x81, sizeof(b));
+					x = a + da;
+					y = b + db;
+					for (i = 0; i < len; i++)
+						x[i] = y[i] = 'A' + i * 13;
+					x[len] = y[len] = '\0';
+					// Differ by a byte with the high bit set or
+					// one just above zero, to trip the bit trick.
+					if (pos >= 0 && pos < len)
+						y[pos] = (pos & 1) ? 0x80 : 0x01;
+
+					bad += strlen(x) != len;
+					for (k = 0; k < len + 4; k++)
+						bad += strnlen(x, k) != MIN(k, len);
+					bad += sign(strcmp(x, y)) !=
+						sign(strcmp_bytes(x, y));
+					bad += sign(memcmp(x, y, len + 1)) !=
+						sign(memcmp_bytes(x, y, len + 1));
+					for (c = 0; c < 256; c++) {
+						e = strfind_bytes(y, c);
+						bad += strfind(y, c) != e;
+						bad += strchr(y, c) != (*e ? e : 0);
+					}
+				}
+	return bad;
+}
+
+#define STRING_BYTES	(1 << 20)	// scanned per measurement
+
+static void
+bench_string(void)
+{
+	static const int lens[] = { 8, 64, 1024 };
+	static char a[1024 + 4], b[1024 + 4];
+	uint64_t t0, ns[8];
+	char *x, *y, bytes[12];
+	int i, j, n, len, iters;
+
+	cprintf("  %d mismatches against the byte versions\n",
+		bench_string_check());
+
+	cprintf("  MB/s, word/byte  len   strlen        strcmp        "
+		"strfind       memcmp\n");
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		len = lens[i];
+		iters = STRING_BYTES / len;
+		// Start one byte in, so the head alignment loops run too.
+		x = a + 1;
+		y = b + 1;
+		memset(x, 'x', len - 1);
+		memset(y, 'x', len - 1);
+		x[len - 1] = y[len - 1] = '\0';
+
+		n = 0;
+#define MEASURE(expr)						\
+		do {						\
+			t0 = time_ns();				\
+			for (j = 0; j < iters; j++)		\
+				(void) (expr);			\
+			ns[n++] = time_ns() - t0;		\
+		} while (0)
+		MEASURE(strlen(x));
+		MEASURE(strlen_bytes(x));
+		MEASURE(strcmp(x, y));
+		MEASURE(strcmp_bytes(x, y));
+		MEASURE(strfind(x, '!'));
+		MEASURE(strfind_bytes(x, '!'));
+		MEASURE(memcmp(x, y, len));
+		MEASURE(memcmp_bytes(x, y, len));
+#undef MEASURE
+
+		cprintf("  %20u", len);
+		for (n = 0; n < 8; n += 2) {
+			// printfmt left-justifies only strings.
+			snprintf(bytes, sizeof(bytes), "%u",
+				 bench_mbps((uint64_t) len * iters, ns[n + 1]));
+			cprintf("  %5u/%-6s",
+				bench_mbps((uint64_t) len * iters, ns[n]), bytes);
+		}
+		cprintf("\n");
+	}
+}
+
+static void
+op_page_alloc(void *arg)
+{
+	page_free(page_alloc((int) arg));
+}
+
+static void
+bench_page(void)
+{
+	bench_header();
+	bench_time("alloc+free", op_page_alloc, (void *) 0);
+	bench_time("alloc zero+free", op_page_alloc, (void *) ALLOC_ZERO);
+}
+
+// The page-table operations work on a user page directory that has
+// never run, so has no ASID and costs page_remove() no TLB
+// maintenance; tlb_invalidate() is timed on its own.  A page mapped
+// at BENCH_VA keeps its L2 table in place throughout.
+#define BENCH_VA	0x10000000
+
+struct PgtableArg {
+	pde_t *pa_pgdir;
+	struct PageInfo *pa_pp;
+};
+
+static void
+op_insert_remove(void *arg)
+{
+	struct PgtableArg *pa = arg;
+
+	if (page_insert(pa->pa_pgdir, pa->pa_pp, (void *) (BENCH_VA + PGSIZE),
+			PTE_RW_U) < 0)
+		panic("bench: out of memory");
+	page_remove(pa->pa_pgdir, (void *) (BENCH_VA + PGSIZE));
+}
+
+static void
+op_walk_hit(void *arg)
+{
+	struct PgtableArg *pa = arg;
+
+	if (!pgdir_walk(pa->pa_pgdir, (void *) BENCH_VA, 0))
+		panic("bench: walk missed");
+}
+
+static void
+op_walk_miss(void *arg)
+{
+	struct PgtableArg *pa = arg;
+
+	if (pgdir_walk(pa->pa_pgdir, (void *) (BENCH_VA + PTSIZE), 0))
+		panic("bench: walk hit");
+}
+
+static void
+op_tlb_invalidate(void *arg)
+{
+	tlb_invalidate(KERN_ASID, arg);
+}
+
+static void
+bench_pgtable(void)
+{
+	static char tlb_page[PGSIZE] __attribute__((aligned(PGSIZE)));
+	struct PgtableArg pa;
+
+	pa.pa_pgdir = pgdir_create();
+	if ((pa.pa_pp = page_alloc(0)))
+		pa.pa_pp->pp_ref++;
+	if (!pa.pa_pgdir || !pa.pa_pp
+	    || page_insert(pa.pa_pgdir, pa.pa_pp, (void *) BENCH_VA, PTE_RW_U) < 0) {
+		cprintf("  out of memory\n");
+		goto out;
+	}
+
+	bench_header();
+	bench_time("insert+remove", op_insert_remove, &pa);
+	bench_time("pgdir_walk hit", op_walk_hit, &pa);
+	bench_time("pgdir_walk miss", op_walk_miss, &pa);
+	bench_time("tlb_invalidate", op_tlb_invalidate, tlb_page);
+
+out:
+	if (pa.pa_pgdir)
+		pgdir_destroy(pa.pa_pgdir);
+	if (pa.pa_pp)
+		page_decref(pa.pa_pp);
+}
+
+struct MemArg {
+	char *ma_dst;
+	char *ma_src;
+	size_t ma_size;
+};
+
+static void
+op_memset(void *arg)
+{
+	struct MemArg *ma = arg;
+
+	memset(ma->ma_dst, 0, ma->ma_size);
+}
+
+static void
+op_memcpy(void *arg)
+{
+	struct MemArg *ma = arg;
+
+	memcpy(ma->ma_dst, ma->ma_src, ma->ma_size);
+}
+
+static void
+bench_mem(void)
+{
+	static const size_t sizes[] = { 16, 256, 4096, 65536 };
+	struct PageInfo *dpp, *spp;
+	struct MemArg ma;
+	char label[32];
+	int i;
+
+	// 64KB each, enough for the largest size.
+	dpp = page_alloc_order(4, 0);
+	spp = page_alloc_order(4, 0);
+	if (!dpp || !spp) {
+		cprintf("  out of memory\n");
+		goto out;
+	}
+	ma.ma_dst = page2kva(dpp);
+	ma.ma_src = page2kva(spp);
+
+	bench_header();
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		ma.ma_size = sizes[i];
+		snprintf(label, sizeof(label), "memset %u", sizes[i]);
+		bench_time(label, op_memset, &ma);
+		snprintf(label, sizeof(label), "memcpy %u", sizes[i]);
+		bench_time(label, op_memcpy, &ma);
+	}
+
+out:
+	if (dpp)
+		page_free_order(dpp, 4);
+	if (spp)
+		page_free_order(spp, 4);
+}
+
+// Look up a few pcs in turn, from all over the kernel.
+static void
+op_debuginfo(void *arg)
+{
+	static const uintptr_t pcs[] = {
+		(uintptr_t) mon_bench, (uintptr_t) page_insert,
+		(uintptr_t) cprintf, (uintptr_t) debuginfo_eip,
+	};
+	uint32_t *i = arg;
+	struct Eipdebuginfo info;
+
+	debuginfo_eip(pcs[*i % (sizeof(pcs) / sizeof(pcs[0]))] + 8, &info);
+	(*i)++;
+}
+
+static void
+bench_debuginfo(void)
+{
+	uint32_t i = 0;
+
+	bench_header();
+	bench_time("debuginfo_eip", op_debuginfo, &i);
+}
+
+static struct Bench benches[] = {
+	{ "page", "page_alloc/page_free, plain and ALLOC_ZERO", bench_page },
+	{ "pgtable", "page_insert/page_remove, pgdir_walk, tlb_invalidate",
+	  bench_pgtable },
+	{ "mem", "memset and memcpy at several sizes", bench_mem },
+	{ "printfmt", "vsnprintf of %d, %x, %08x and a mix", bench_printfmt },
+	{ "debuginfo", "debuginfo_eip", bench_debuginfo },
+	{ "memfunc", "memset/memcpy against the byte versions", bench_memfunc },
+	{ "string", "strlen/strcmp/strfind/memcmp against the byte versions",
+	  bench_string },
+};
+#define NBENCHES (sizeof(benches)/sizeof(benches[0]))
+
+int
+mon_bench(int argc, char **argv, struct Trapframe *tf)
+{
+	int i, j;
+
+	if (argc < 2) {
+		cprintf("usage: bench <name>... | all\n");
+		for (i = 0; i < NBENCHES; i++)
+			cprintf("  %-12s %s\n", benches[i].b_name, benches[i].b_desc);
+		return 0;
+	}
+	for (j = 1; j < argc; j++)
+		for (i = 0; i < NBENCHES; i++)
+			if (strcmp(argv[j], "all") == 0
+			    || strcmp(argv[j], benches[i].b_name) == 0) {
+				cprintf("%s:\n", benches[i].b_name);
+				benches[i].b_run();
+			}
+	return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef JOS_KERN_BENCH_H
+#define JOS_KERN_BENCH_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+// A microbenchmark the bench monitor command can run by name.
+struct Bench {
+	const char *b_name;
+	const char *b_desc;
+	void (*b_run)(void);
+};
+
+#endif	// !JOS_KERN_BENCH_H
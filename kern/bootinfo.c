@@ -0,0 +1,154 @@
+// Boot information handed over by the firmware or boot loader.
+//
+// On entry r2 holds the physical address of either an ATAG list or a
+// flattened device tree (FDT).  This runs before mem_init() switches to
+// kern_pgdir, so the information has to lie in the first EARLYMEM bytes
+// of physical memory.
+
+#include <inc/types.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+
+#include <kern/bootinfo.h>
+
+// ATAG list: a sequence of tags, each starting with its size in words.
+#define ATAG_NONE	0x00000000
+#define ATAG_CORE	0x54410001
+#define ATAG_MEM	0x54410002
+
+struct Atag {
+	uint32_t at_size;	// in words, including this header
+	uint32_t at_tag;
+	uint32_t at_data[];
+};
+
+// Flattened device tree.  All fields are big-endian.
+#define FDT_MAGIC	0xd00dfeed
+#define FDT_BEGIN_NODE	1
+#define FDT_END_NODE	2
+#define FDT_PROP	3
+#define FDT_NOP		4
+#define FDT_END		9
+
+struct FdtHeader {
+	uint32_t fh_magic;
+	uint32_t fh_totalsize;
+	uint32_t fh_off_dt_struct;
+	uint32_t fh_off_dt_strings;
+	uint32_t fh_off_mem_rsvmap;
+	uint32_t fh_version;
+	uint32_t fh_last_comp_version;
+	uint32_t fh_boot_cpuid_phys;
+	uint32_t fh_size_dt_strings;
+	uint32_t fh_size_dt_struct;
+};
+
+static inline uint32_t
+be32(const void *p)
+{
+	const uint8_t *b = p;
+	return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+static physaddr_t
+atag_memsize(const struct Atag *at, const char *lim)
+{
+	uint64_t top = 0;
+
+	if (at->at_tag != ATAG_CORE)
+		return 0;
+	for (; (const char *) at < lim && at->at_size != 0
+	       && at->at_tag != ATAG_NONE;
+	     at = (const struct Atag *) ((const uint32_t *) at + at->at_size))
+		// ATAG_MEM: size, then start
+		if (at->at_tag == ATAG_MEM && at->at_size >= 4)
+			top = MAX(top, (uint64_t) at->at_data[1] + at->at_data[0]);
+	return MIN(top, (uint64_t) ROUNDDOWN(~0U, PGSIZE));
+}
+
+// Read an 'ncells'-cell big-endian number.
+static uint64_t
+fdt_cells(const uint8_t *p, int ncells)
+{
+	uint64_t v = 0;
+
+	while (ncells-- > 0) {
+		v = (v << 32) | be32(p);
+		p += 4;
+	}
+	return v;
+}
+
+// Find the highest address covered by the "reg" property of the
+// /memory node(s).
+static physaddr_t
+fdt_memsize(const uint8_t *fdt, const char *lim)
+{
+	const struct FdtHeader *fh = (const struct FdtHeader *) fdt;
+	const uint8_t *p, *end;
+	const char *strings, *name;
+	int depth = 0, inmem = 0, acells = 2, scells = 1;
+	uint32_t len;
+	uint64_t top = 0;
+
+	if ((const char *) fdt + be32(&fh->fh_totalsize) > lim)
+		return 0;
+	p = fdt + be32(&fh->fh_off_dt_struct);
+	end = p + be32(&fh->fh_size_dt_struct);
+	strings = (const char *) fdt + be32(&fh->fh_off_dt_strings);
+
+	while (p < end) {
+		switch (be32(p)) {
+		case FDT_BEGIN_NODE:
+			name = (const char *) p + 4;
+			depth++;
+			inmem = depth == 2 && strncmp(name, "memory", 6) == 0
+				&& (name[6] == '\0' || name[6] == '@');
+			p += 4 + ROUNDUP(strlen(name) + 1, 4);
+			break;
+		case FDT_END_NODE:
+			inmem = 0;
+			depth--;
+			p += 4;
+			break;
+		case FDT_PROP:
+			len = be32(p + 4);
+			name = strings + be32(p + 8);
+			p += 12;
+			if (depth == 1 && strcmp(name, "#address-cells") == 0)
+				acells = be32(p);
+			else if (depth == 1 && strcmp(name, "#size-cells") == 0)
+				scells = be32(p);
+			else if (inmem && strcmp(name, "reg") == 0) {
+				uint32_t stride = (acells + scells) * 4, off;
+				for (off = 0; off + stride <= len; off += stride)
+					top = MAX(top, fdt_cells(p + off, acells)
+						  + fdt_cells(p + off + acells * 4, scells));
+			}
+			p += ROUNDUP(len, 4);
+			break;
+		case FDT_NOP:
+			p += 4;
+			break;
+		case FDT_END:
+			p = end;
+			break;
+		default:
+			return 0;
+		}
+	}
+	return MIN(top, (uint64_t) ROUNDDOWN(~0U, PGSIZE));
+}
+
+physaddr_t
+bootinfo_memsize(physaddr_t pa)
+{
+	const char *va = (const char *) (KERNBASE + pa);
+	const char *lim = (const char *) (KERNBASE + EARLYMEM);
+
+	if (pa == 0 || pa % 4 != 0 || pa + sizeof(struct FdtHeader) > EARLYMEM)
+		return 0;
+	if (be32(va) == FDT_MAGIC)
+		return fdt_memsize((const uint8_t *) va, lim);
+	return atag_memsize((const struct Atag *) va, lim);
+}
@@ -0,0 +1,14 @@
+#ifndef JOS_KERN_BOOTINFO_H
+#define JOS_KERN_BOOTINFO_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Size of RAM, as reported by the ATAG list or flattened device tree the
+// boot loader left at physical address 'pa'.  Returns 0 if neither is
+// found there.
+physaddr_t bootinfo_memsize(physaddr_t pa);
+
+#endif	// !JOS_KERN_BOOTINFO_H
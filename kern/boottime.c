@@ -0,0 +1,79 @@
+// Boot timeline: tracepoints from _start to the monitor prompt, and
+// the boottime monitor command that prints them.
+//
+// kern/entry.S records the first few with the MMU and caches still
+// off, which is why the table lives in .data: it has to survive the
+// clearing of bss, and entry.S finds it at its physical address until
+// the MMU is on.
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+#include <inc/memlayout.h>
+
+#include <kern/boottime.h>
+#include <kern/monitor.h>
+
+#define BOOT_NTRACE	48
+
+enum
+{
+    ST_CLO = (MMIOBASE + 0x3004),	// system timer, low 32 bits
+};
+
+static inline uint32_t mmio_read(uint32_t reg)
+{
+	return *(volatile uint32_t *)reg;
+}
+
+struct BootTrace boot_traces[BOOT_NTRACE] = {
+	[BOOT_FIRMWARE]	= { "firmware" },
+	[BOOT_MMU]	= { "mmu" },
+	[BOOT_CACHE]	= { "cache_init" },
+	[BOOT_BSS]	= { "bss" },
+};
+
+static int boot_ntraces = BOOT_NENTRY;
+static bool boot_done;
+
+// Record that boot phase 'name' just finished.  Once the table is full
+// or boot_trace_end() has run, does nothing.
+void
+boot_trace(const char *name)
+{
+	if (boot_done || boot_ntraces == BOOT_NTRACE)
+		return;
+	boot_traces[boot_ntraces].bt_name = name;
+	boot_traces[boot_ntraces].bt_usec = mmio_read(ST_CLO);
+	boot_ntraces++;
+}
+
+// Record the last phase of boot, and print how long boot took, so
+// that every boot log shows it.
+void
+boot_trace_end(const char *name)
+{
+	if (boot_done)
+		return;
+	boot_trace(name);
+	boot_done = 1;
+	cprintf("boot: %u us from power-on to %s\n",
+		boot_traces[boot_ntraces - 1].bt_usec, name);
+}
+
+int
+mon_boottime(int argc, char **argv, struct Trapframe *tf)
+{
+	uint32_t total, prev = 0, delta, pct;
+	int i;
+
+	total = boot_traces[boot_ntraces - 1].bt_usec;
+	cprintf("      usec      delta      %%  phase\n");
+	for (i = 0; i < boot_ntraces; i++) {
+		delta = boot_traces[i].bt_usec - prev;
+		prev = boot_traces[i].bt_usec;
+		pct = total ? (uint64_t) delta * 1000 / total : 0;
+		cprintf("%10u %10u %4u.%u%%  %s\n", boot_traces[i].bt_usec,
+			delta, pct / 10, pct % 10, boot_traces[i].bt_name);
+	}
+	return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef JOS_KERN_BOOTTIME_H
+#define JOS_KERN_BOOTTIME_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+// Boot tracepoints.  Each records when the boot phase it names
+// finished, in microseconds of the BCM2835 system timer, which counts
+// from power-on and can be read before the MMU is on.
+
+// Slots kern/entry.S fills in, and the layout it fills them in with.
+#define BOOT_FIRMWARE	0	// reached _start
+#define BOOT_MMU	1	// MMU on, running at KERNBASE
+#define BOOT_CACHE	2	// cache_init() done
+#define BOOT_BSS	3	// bss cleared
+#define BOOT_NENTRY	4
+
+#define BT_USEC		4	// offset of bt_usec
+#define BT_SIZE		8
+
+#ifndef __ASSEMBLER__
+
+#include <inc/types.h>
+
+struct BootTrace {
+	const char *bt_name;
+	uint32_t bt_usec;
+};
+
+void	boot_trace(const char *name);
+void	boot_trace_end(const char *name);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif	// !JOS_KERN_BOOTTIME_H
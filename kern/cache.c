@@ -0,0 +1,200 @@
+// L1 cache and branch predictor maintenance.
+//
+// The kernel runs on the ARM1176 (ARMv6) of the original Raspberry Pi
+// and on the Cortex-A7 (ARMv7) of the Pi 2.  Both accept the same CP15
+// operations by virtual address, but ARMv7 dropped the operations on
+// the entire data cache, so there we walk the cache by set/way instead.
+
+#include <inc/types.h>
+#include <inc/arm.h>
+#include <inc/mmu.h>
+
+#include <kern/cache.h>
+
+// cache_init() runs before bss is cleared, so keep its results in
+// initialized data.  The defaults describe the ARM1176.
+static int cache_armv7 = -1;
+static uint32_t dcache_line = 32;
+static uint32_t icache_line = 32;
+
+enum {
+	SETWAY_INVALIDATE,
+	SETWAY_CLEAN,
+	SETWAY_FLUSH,
+};
+
+// Apply a set/way operation to every data or unified cache level up
+// to the level of coherency (ARMv7 only).
+static void
+dcache_setway_all(int op)
+{
+	uint32_t clidr, ccsidr, loc, level, ctype;
+	uint32_t linelog, nways, nsets, wayshift, way, set, sw;
+
+	asm volatile("mrc p15, 1, %0, c0, c0, 1" : "=r" (clidr));
+	loc = (clidr >> 24) & 0x7;
+	for (level = 0; level < loc; level++) {
+		ctype = (clidr >> (level * 3)) & 0x7;
+		if (ctype < 2)		// no data cache at this level
+			continue;
+		asm volatile("mcr p15, 2, %0, c0, c0, 0" : : "r" (level << 1));
+		isb();
+		asm volatile("mrc p15, 1, %0, c0, c0, 0" : "=r" (ccsidr));
+		linelog = (ccsidr & 0x7) + 4;
+		nways = ((ccsidr >> 3) & 0x3FF) + 1;
+		nsets = ((ccsidr >> 13) & 0x7FFF) + 1;
+		wayshift = nways > 1 ? __builtin_clz(nways - 1) : 0;
+		for (way = 0; way < nways; way++)
+			for (set = 0; set < nsets; set++) {
+				sw = (way << wayshift) | (set << linelog) |
+					(level << 1);
+				switch (op) {
+				case SETWAY_INVALIDATE:
+					asm volatile("mcr p15, 0, %0, c7, c6, 2"
+						     : : "r" (sw));
+					break;
+				case SETWAY_CLEAN:
+					asm volatile("mcr p15, 0, %0, c7, c10, 2"
+						     : : "r" (sw));
+					break;
+				default:
+					asm volatile("mcr p15, 0, %0, c7, c14, 2"
+						     : : "r" (sw));
+					break;
+				}
+			}
+	}
+	dsb();
+}
+
+void
+cache_init(void)
+{
+	uint32_t mmfr0, ctr, sctlr;
+
+	// The VMSA field of ID_MMFR0 is 3 on ARMv6 and 4 or more on ARMv7.
+	asm volatile("mrc p15, 0, %0, c0, c1, 4" : "=r" (mmfr0));
+	cache_armv7 = (mmfr0 & 0xF) >= 4;
+
+	// Smallest line sizes, from the cache type register.
+	asm volatile("mrc p15, 0, %0, c0, c0, 1" : "=r" (ctr));
+	if ((ctr >> 29) == 0x4) {
+		dcache_line = 4 << ((ctr >> 16) & 0xF);
+		icache_line = 4 << (ctr & 0xF);
+	} else {
+		dcache_line = 8 << ((ctr >> 12) & 0x3);
+		icache_line = 8 << (ctr & 0x3);
+	}
+
+	// Cache contents are undefined out of reset, so invalidate
+	// everything before turning the caches on.  If somebody already
+	// turned the data cache on, its dirty lines must be kept.
+	sctlr = read_sctlr();
+	if (sctlr & SCTLR_C)
+		dcache_flush_all();
+	else
+		dcache_invalidate_all();
+	icache_invalidate_all();
+	bp_invalidate_all();
+	dsb();
+
+	write_sctlr(sctlr | SCTLR_C | SCTLR_I | SCTLR_Z);
+	isb();
+}
+
+// Smallest data cache line, for callers that align data to it.
+size_t
+dcache_line_size(void)
+{
+	return dcache_line;
+}
+
+void
+icache_invalidate_all(void)
+{
+	asm volatile("mcr p15, 0, %0, c7, c5, 0" : : "r" (0) : "memory");
+	bp_invalidate_all();
+}
+
+void
+bp_invalidate_all(void)
+{
+	asm volatile("mcr p15, 0, %0, c7, c5, 6" : : "r" (0));
+	isb();
+}
+
+void
+dcache_clean_all(void)
+{
+	if (cache_armv7 > 0)
+		dcache_setway_all(SETWAY_CLEAN);
+	else
+		asm volatile("mcr p15, 0, %0, c7, c10, 0" : : "r" (0));
+	dsb();
+}
+
+void
+dcache_invalidate_all(void)
+{
+	if (cache_armv7 > 0)
+		dcache_setway_all(SETWAY_INVALIDATE);
+	else
+		asm volatile("mcr p15, 0, %0, c7, c6, 0" : : "r" (0) : "memory");
+	dsb();
+}
+
+void
+dcache_flush_all(void)
+{
+	if (cache_armv7 > 0)
+		dcache_setway_all(SETWAY_FLUSH);
+	else
+		asm volatile("mcr p15, 0, %0, c7, c14, 0" : : "r" (0) : "memory");
+	dsb();
+}
+
+void
+icache_invalidate_range(const void *va, size_t len)
+{
+	uintptr_t p = ROUNDDOWN((uintptr_t) va, icache_line);
+	uintptr_t end = (uintptr_t) va + len;
+
+	for (; p < end; p += icache_line)
+		asm volatile("mcr p15, 0, %0, c7, c5, 1" : : "r" (p));
+	bp_invalidate_all();
+}
+
+void
+dcache_clean_range(const void *va, size_t len)
+{
+	uintptr_t p = ROUNDDOWN((uintptr_t) va, dcache_line);
+	uintptr_t end = (uintptr_t) va + len;
+
+	for (; p < end; p += dcache_line)
+		asm volatile("mcr p15, 0, %0, c7, c10, 1" : : "r" (p));
+	dsb();
+}
+
+// Lines only partly inside the range may hold unrelated dirty data,
+// so callers should pass cache-line aligned buffers.
+void
+dcache_invalidate_range(const void *va, size_t len)
+{
+	uintptr_t p = ROUNDDOWN((uintptr_t) va, dcache_line);
+	uintptr_t end = (uintptr_t) va + len;
+
+	for (; p < end; p += dcache_line)
+		asm volatile("mcr p15, 0, %0, c7, c6, 1" : : "r" (p) : "memory");
+	dsb();
+}
+
+void
+dcache_flush_range(const void *va, size_t len)
+{
+	uintptr_t p = ROUNDDOWN((uintptr_t) va, dcache_line);
+	uintptr_t end = (uintptr_t) va + len;
+
+	for (; p < end; p += dcache_line)
+		asm volatile("mcr p15, 0, %0, c7, c14, 1" : : "r" (p) : "memory");
+	dsb();
+}
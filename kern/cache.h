@@ -0,0 +1,28 @@
+#ifndef JOS_KERN_CACHE_H
+#define JOS_KERN_CACHE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Invalidate and turn on the L1 caches and branch prediction.
+// Called from entry.S once the MMU is on, before bss is cleared.
+void	cache_init(void);
+
+size_t	dcache_line_size(void);
+
+// Whole-cache maintenance.
+void	icache_invalidate_all(void);
+void	bp_invalidate_all(void);
+void	dcache_clean_all(void);
+void	dcache_invalidate_all(void);
+void	dcache_flush_all(void);		// clean, then invalidate
+
+// Maintenance by virtual address range [va, va + len).
+void	icache_invalidate_range(const void *va, size_t len);
+void	dcache_clean_range(const void *va, size_t len);
+void	dcache_invalidate_range(const void *va, size_t len);
+void	dcache_flush_range(const void *va, size_t len);
+
+#endif	// !JOS_KERN_CACHE_H
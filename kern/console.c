@@ -3,8 +3,11 @@
 #include <inc/memlayout.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/arm.h>
 
 #include <kern/console.h>
+#include <kern/irq.h>
+#include <kern/dmesg.h>
 
 // Ref. http://wiki.osdev.org/ARM_RaspberryPi_Tutorial_C
 
@@ -59,10 +62,35 @@ enum
 };
 
 
+// Flag register bits.
+#define UART_FR_RXFE	(1 << 4)	// receive FIFO empty
+#define UART_FR_TXFF	(1 << 5)	// transmit FIFO full
+#define UART_FR_TXFE	(1 << 7)	// transmit FIFO empty
+
+// Interrupt bits, the same in IMSC, RIS, MIS and ICR.
+#define UART_INT_RX	(1 << 4)
+#define UART_INT_TX	(1 << 5)
+#define UART_INT_RT	(1 << 6)	// receive timeout
+
+#define UART_FIFO_DEPTH	16
+
+// Output waits here for the transmit interrupt to move it into the
+// FIFO.  rpos and wpos run freely and are masked on use.
+#define UART_TXBUFSIZE	4096
+
+static struct {
+	uint8_t buf[UART_TXBUFSIZE];
+	uint32_t rpos;
+	uint32_t wpos;
+} uart_tx;
+
+static bool uart_irq_on;	// the UART interrupt is routed to us
+static bool uart_tx_busy;	// the transmit interrupt is unmasked
+
 static 
 int uart_proc_data()
 {
-    if (mmio_read(UART0_FR) & (1 << 4))
+    if (mmio_read(UART0_FR) & UART_FR_RXFE)
     	return -1;
     return mmio_read(UART0_DR);
 }
@@ -73,12 +101,100 @@ uart_intr(void)
 	cons_intr(uart_proc_data);
 }
 
+// Move queued output into the transmit FIFO until either runs out.
+// An empty FIFO takes a whole FIFO's worth with no further checks.
+static void
+uart_tx_fill(void)
+{
+	uint32_t fr;
+	int room;
+
+	while (uart_tx.rpos != uart_tx.wpos) {
+		fr = mmio_read(UART0_FR);
+		if (fr & UART_FR_TXFF)
+			break;
+		room = (fr & UART_FR_TXFE) ? UART_FIFO_DEPTH : 1;
+		for (; room > 0 && uart_tx.rpos != uart_tx.wpos; room--)
+			mmio_write(UART0_DR,
+				   uart_tx.buf[uart_tx.rpos++ % UART_TXBUFSIZE]);
+	}
+}
+
+// Empty the queue by busy-waiting, for when the interrupt cannot.
+static void
+uart_tx_drain(void)
+{
+	while (uart_tx.rpos != uart_tx.wpos) {
+		while (mmio_read(UART0_FR) & UART_FR_TXFF)
+			;
+		uart_tx_fill();
+	}
+}
+
+static void
+uart_irq(struct Trapframe *tf, void *arg)
+{
+	uint32_t mis = mmio_read(UART0_MIS);
+
+	if (mis & (UART_INT_RX | UART_INT_RT)) {
+		cons_intr(uart_proc_data);
+		mmio_write(UART0_ICR, UART_INT_RX | UART_INT_RT);
+	}
+	if (mis & UART_INT_TX) {
+		mmio_write(UART0_ICR, UART_INT_TX);
+		uart_tx_fill();
+		if (uart_tx.rpos == uart_tx.wpos) {
+			mmio_write(UART0_IMSC, UART_INT_RX | UART_INT_RT);
+			uart_tx_busy = false;
+		}
+	}
+}
+
+// Queue 'n' bytes for output.  Normally this returns at once and the
+// transmit interrupt sends them.  Before interrupts are set up, and
+// whenever IRQs are masked (in trap handlers, say), the queue is
+// drained on the spot so that nothing is stranded in it.
+static void
+uart_write(const char *buf, size_t n)
+{
+	uint32_t cpsr = intr_save();
+	size_t off, len;
+
+	while (n > 0) {
+		if (uart_tx.wpos - uart_tx.rpos == UART_TXBUFSIZE) {
+			while (mmio_read(UART0_FR) & UART_FR_TXFF)
+				;
+			uart_tx_fill();
+			continue;
+		}
+		off = uart_tx.wpos % UART_TXBUFSIZE;
+		len = MIN(n, UART_TXBUFSIZE - (uart_tx.wpos - uart_tx.rpos));
+		len = MIN(len, UART_TXBUFSIZE - off);
+		memcpy(&uart_tx.buf[off], buf, len);
+		uart_tx.wpos += len;
+		buf += len;
+		n -= len;
+	}
+
+	if (!uart_irq_on || (cpsr & PSR_I))
+		uart_tx_drain();
+	else if (!uart_tx_busy) {
+		// The transmit interrupt only fires as the FIFO drains
+		// past its trigger level, so prime the FIFO to start it.
+		uart_tx_fill();
+		if (uart_tx.rpos != uart_tx.wpos) {
+			uart_tx_busy = true;
+			mmio_write(UART0_IMSC,
+				   UART_INT_RX | UART_INT_RT | UART_INT_TX);
+		}
+	}
+	intr_restore(cpsr);
+}
+
 static void
 uart_putc(unsigned char byte)
 {
-	// Wait for UART to become ready to transmit.
-	while ( mmio_read(UART0_FR) & (1 << 5) ) { }
-	mmio_write(UART0_DR, byte);
+	uart_write((char *) &byte, 1);
 }
 
 static void
@@ -113,9 +229,11 @@ uart_init(void)
 	// Enable FIFO & 8 bit data transmissio (1 stop bit, no parity).
 	mmio_write(UART0_LCRH, (1 << 4) | (1 << 5) | (1 << 6));
  
-	// Mask all interrupts.
-	mmio_write(UART0_IMSC, (1 << 1) | (1 << 4) | (1 << 5) | (1 << 6) |
-	                       (1 << 7) | (1 << 8) | (1 << 9) | (1 << 10));
+	// Interrupt as soon as the transmit FIFO is down to 1/8 full or
+	// the receive FIFO is 1/8 full.  Keep every interrupt masked
+	// until cons_irq_init().
+	mmio_write(UART0_IFLS, 0);
+	mmio_write(UART0_IMSC, 0);
  
 	// Enable UART0, receive & transfer part of UART.
 	mmio_write(UART0_CR, (1 << 0) | (1 << 8) | (1 << 9));
@@ -156,6 +274,7 @@ int
 cons_getc(void)
 {
 	unsigned char c;
+	uint32_t cpsr = intr_save();
 
 	// poll for any pending input characters,
 	// so that this function works even when interrupts are disabled
@@ -167,8 +286,10 @@ cons_getc(void)
 		c = cons.buf[cons.rpos++];
 		if (cons.rpos == CONSBUFSIZE)
 			cons.rpos = 0;
+		intr_restore(cpsr);
 		return c;
 	}
+	intr_restore(cpsr);
 	return 0;
 }
 
@@ -179,6 +300,13 @@ cons_putc(int c)
 	uart_putc(c);
 }
 
+// output a run of characters to the console
+void
+cons_write(const char *buf, size_t n)
+{
+	uart_write(buf, n);
+}
+
 // initialize the console devices
 void
 cons_init(void)
@@ -186,12 +314,25 @@ cons_init(void)
 	uart_init();
 }
 
+// Switch the console over to interrupts, once trap_init() has set up
+// the interrupt controller.
+void
+cons_irq_init(void)
+{
+	irq_register(IRQ_UART, uart_irq, NULL);
+	mmio_write(UART0_ICR, 0x7FF);
+	mmio_write(UART0_IMSC, UART_INT_RX | UART_INT_RT);
+	uart_irq_on = true;
+}
+
 
 // `High'-level console I/O.  Used by readline and cprintf.
 
 void
 cputchar(int c)
 {
+	// Keep it in order with cprintf output still in the log.
+	dmesg_drain();
 	cons_putc(c);
 }
 
@@ -200,8 +341,9 @@ getchar(void)
 {
 	int c;
 
+	// The CPU has nothing better to do than show the log.
 	while ((c = cons_getc()) == 0)
-		/* do nothing */;
+		dmesg_drain();
 	return c;
 }
 
@@ -4,7 +4,11 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/types.h>
+
 void cons_init(void);
+void cons_irq_init(void);
 int cons_getc(void);
+void cons_write(const char *buf, size_t n);
 
 #endif
@@ -0,0 +1,213 @@
+// The kernel log.
+//
+// cprintf() output is appended to an in-memory ring as timestamped
+// records and reaches the console later, when dmesg_drain() runs: from
+// getchar() while the CPU waits for input, from _panic(), or from a
+// writer that finds the ring full.  So the cost of logging is usually a
+// copy, not a wait on the UART.
+//
+// Appending takes no lock: a writer claims space by compare-and-swap
+// on dm_head, fills its record in, and publishes it last by storing
+// the record's own position in its header.  Interrupt handlers can
+// therefore log while the code they interrupted is halfway through a
+// record.  Only one reader, the thread draining to the console, ever
+// consumes records; dm_draining keeps a writer that interrupted it from
+// draining too.
+//
+// Records between dm_tail and dm_con have reached the console and are
+// kept for the dmesg command; a writer short of space evicts them,
+// oldest first.  Records not yet drained are never overwritten: a
+// writer that finds the ring full of them drains it itself, and only
+// if that frees nothing, because it interrupted the drain or the
+// writer of the oldest record, drops its output and counts it in
+// dm_dropped.
+
+#include <inc/types.h>
+#include <inc/string.h>
+#include <inc/stdio.h>
+#include <inc/arm.h>
+
+#include <kern/dmesg.h>
+#include <kern/console.h>
+#include <kern/time.h>
+
+#define DMESG_SIZE	(16 * 1024)	// a power of two
+
+// Records start on 16-byte boundaries, so a header never wraps.
+struct DmesgRec {
+	uint32_t dr_pos;	// where the record starts, once complete
+	uint32_t dr_len;	// text bytes following the header
+	uint64_t dr_time;	// time_ns() when it was written
+};
+
+#define REC_SIZE(len)	ROUNDUP(sizeof(struct DmesgRec) + (len), 16)
+
+// Positions run freely and are reduced modulo DMESG_SIZE on use.
+static char dm_buf[DMESG_SIZE] __attribute__((aligned(16)));
+static volatile uint32_t dm_head;	// next free byte
+static volatile uint32_t dm_tail;	// oldest record kept
+static volatile uint32_t dm_con;	// next record for the console
+static volatile uint32_t dm_dropped;	// bytes lost to a full ring
+static volatile uint32_t dm_draining;	// dmesg_drain() is running
+
+static inline struct DmesgRec *
+rec_at(uint32_t pos)
+{
+	return (struct DmesgRec *) &dm_buf[pos % DMESG_SIZE];
+}
+
+// Copy into and out of the ring, across the wrap if need be.
+static void
+ring_put(uint32_t pos, const char *src, size_t n)
+{
+	size_t off = pos % DMESG_SIZE, first = MIN(n, DMESG_SIZE - off);
+
+	memcpy(&dm_buf[off], src, first);
+	memcpy(dm_buf, src + first, n - first);
+}
+
+static void
+ring_get(uint32_t pos, char *dst, size_t n)
+{
+	size_t off = pos % DMESG_SIZE, first = MIN(n, DMESG_SIZE - off);
+
+	memcpy(dst, &dm_buf[off], first);
+	memcpy(dst + first, dm_buf, n - first);
+}
+
+// Drop the oldest record to make room, if it has been on the console.
+// A failed compare-and-swap means another writer dropped it first.
+static bool
+dmesg_evict(uint32_t tail)
+{
+	if (tail == dm_con)
+		return false;
+	__sync_bool_compare_and_swap(&dm_tail, tail,
+				     tail + REC_SIZE(rec_at(tail)->dr_len));
+	return true;
+}
+
+// Append 'n' bytes of log text as one record.
+void
+dmesg_write(const char *buf, size_t n)
+{
+	uint32_t size = REC_SIZE(n), pos, con;
+	struct DmesgRec *r;
+
+	if (size > DMESG_SIZE / 2) {
+		__sync_fetch_and_add(&dm_dropped, n);
+		return;
+	}
+	for (;;) {
+		pos = dm_head;
+		if (pos + size - dm_tail > DMESG_SIZE) {
+			if (dmesg_evict(dm_tail))
+				continue;
+			con = dm_con;
+			dmesg_drain();
+			if (dm_con == con) {
+				__sync_fetch_and_add(&dm_dropped, n);
+				return;
+			}
+			continue;
+		}
+		if (__sync_bool_compare_and_swap(&dm_head, pos, pos + size))
+			break;
+	}
+
+	r = rec_at(pos);
+	r->dr_len = n;
+	r->dr_time = time_ns();
+	ring_put(pos + sizeof(*r), buf, n);
+	dmb();
+	r->dr_pos = pos;
+}
+
+// The text of the complete record at 'pos' into 'buf', which must hold
+// DMESG_SIZE / 2 bytes.  Returns its length, or -1 if it is not
+// complete yet.
+static int
+dmesg_read(uint32_t pos, char *buf, uint64_t *time)
+{
+	struct DmesgRec *r = rec_at(pos);
+	uint32_t len;
+
+	if (r->dr_pos != pos)
+		return -1;
+	dmb();
+	len = r->dr_len;
+	if (time)
+		*time = r->dr_time;
+	ring_get(pos + sizeof(*r), buf, len);
+	return len;
+}
+
+// Send every complete record not yet shown to the console.
+void
+dmesg_drain(void)
+{
+	static char text[DMESG_SIZE / 2];
+	char msg[48];
+	uint32_t pos, lost;
+	int len;
+
+	if (__sync_lock_test_and_set(&dm_draining, 1))
+		return;
+	while ((pos = dm_con) != dm_head) {
+		if ((len = dmesg_read(pos, text, NULL)) < 0)
+			break;
+		cons_write(text, len);
+		dm_con = pos + REC_SIZE(len);
+	}
+	if (dm_dropped) {
+		lost = __sync_lock_test_and_set(&dm_dropped, 0);
+		len = snprintf(msg, sizeof(msg), "[dmesg: %u bytes lost]\n", lost);
+		cons_write(msg, len);
+	}
+	__sync_lock_release(&dm_draining);
+}
+
+// Print the log kept so far, with the time every line was started.
+void
+dmesg_dump(void)
+{
+	static char text[DMESG_SIZE / 2];
+	char stamp[24];
+	uint32_t pos;
+	uint64_t time;
+	bool bol = true;
+	int len, i, j, n;
+
+	dmesg_drain();
+	for (pos = dm_tail; pos != dm_con; pos += REC_SIZE(len)) {
+		if ((len = dmesg_read(pos, text, &time)) < 0)
+			break;
+		for (i = 0; i < len; i = j) {
+			if (bol) {
+				n = snprintf(stamp, sizeof(stamp), "[%5u.%06u] ",
+					     (uint32_t) (time / NSEC_PER_SEC),
+					     (uint32_t) (time % NSEC_PER_SEC / NSEC_PER_USEC));
+				cons_write(stamp, n);
+			}
+			for (j = i; j < len && text[j] != '\n'; j++)
+				;
+			bol = j < len;
+			if (bol)
+				j++;
+			cons_write(text + i, j - i);
+		}
+	}
+	if (!bol)
+		cons_write("\n", 1);
+}
+
+// Forget every record already on the console.
+void
+dmesg_clear(void)
+{
+	uint32_t tail;
+
+	do {
+		tail = dm_tail;
+	} while (!__sync_bool_compare_and_swap(&dm_tail, tail, dm_con));
+}
@@ -0,0 +1,14 @@
+#ifndef JOS_KERN_DMESG_H
+#define JOS_KERN_DMESG_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+void	dmesg_write(const char *buf, size_t n);
+void	dmesg_drain(void);
+void	dmesg_dump(void);
+void	dmesg_clear(void);
+
+#endif	// !JOS_KERN_DMESG_H
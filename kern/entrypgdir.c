@@ -1,40 +1,44 @@
 #include <inc/memlayout.h>
 #include <inc/mmu.h>
 
+// RAM is mapped with 1MB write-back cacheable sections (C and B set,
+// hence the 0xe); the peripheral sections are device memory and stay
+// uncached.
 pde_t entry_pgdir[NPDENTRIES] __attribute__((aligned(16 * 1024))) = {
-    [0x0] = 0x00000002,
-    [0x1] = 0x00100002,
-    [0x2] = 0x00200002,
-    [0x3] = 0x00300002,
-    [0x4] = 0x00400002,
-    [0x5] = 0x00500002,
-    [0x6] = 0x00600002,
-    [0x7] = 0x00700002,
-    [0x8] = 0x00800002,
-    [0x9] = 0x00900002,
-    [0xa] = 0x00a00002,
-    [0xb] = 0x00b00002,
-    [0xc] = 0x00c00002,
-    [0xd] = 0x00d00002,
-    [0xe] = 0x00e00002,
-    [0xf] = 0x00f00002,
+    [0x0] = 0x0000000e,
+    [0x1] = 0x0010000e,
+    [0x2] = 0x0020000e,
+    [0x3] = 0x0030000e,
+    [0x4] = 0x0040000e,
+    [0x5] = 0x0050000e,
+    [0x6] = 0x0060000e,
+    [0x7] = 0x0070000e,
+    [0x8] = 0x0080000e,
+    [0x9] = 0x0090000e,
+    [0xa] = 0x00a0000e,
+    [0xb] = 0x00b0000e,
+    [0xc] = 0x00c0000e,
+    [0xd] = 0x00d0000e,
+    [0xe] = 0x00e0000e,
+    [0xf] = 0x00f0000e,
 
     [GPIOBASE >> 20] = 0x3f200002,
+    [MMIOBASE >> 20] = 0x3f000002,
 
-    [0xf00] = 0x00000002,
-    [0xf01] = 0x00100002,
-    [0xf02] = 0x00200002,
-    [0xf03] = 0x00300002,
-    [0xf04] = 0x00400002,
-    [0xf05] = 0x00500002,
-    [0xf06] = 0x00600002,
-    [0xf07] = 0x00700002,
-    [0xf08] = 0x00800002,
-    [0xf09] = 0x00900002,
-    [0xf0a] = 0x00a00002,
-    [0xf0b] = 0x00b00002,
-    [0xf0c] = 0x00c00002,
-    [0xf0d] = 0x00d00002,
-    [0xf0e] = 0x00e00002,
-    [0xf0f] = 0x00f00002,
+    [(KERNBASE >> 20) + 0x0] = 0x0000000e,
+    [(KERNBASE >> 20) + 0x1] = 0x0010000e,
+    [(KERNBASE >> 20) + 0x2] = 0x0020000e,
+    [(KERNBASE >> 20) + 0x3] = 0x0030000e,
+    [(KERNBASE >> 20) + 0x4] = 0x0040000e,
+    [(KERNBASE >> 20) + 0x5] = 0x0050000e,
+    [(KERNBASE >> 20) + 0x6] = 0x0060000e,
+    [(KERNBASE >> 20) + 0x7] = 0x0070000e,
+    [(KERNBASE >> 20) + 0x8] = 0x0080000e,
+    [(KERNBASE >> 20) + 0x9] = 0x0090000e,
+    [(KERNBASE >> 20) + 0xa] = 0x00a0000e,
+    [(KERNBASE >> 20) + 0xb] = 0x00b0000e,
+    [(KERNBASE >> 20) + 0xc] = 0x00c0000e,
+    [(KERNBASE >> 20) + 0xd] = 0x00d0000e,
+    [(KERNBASE >> 20) + 0xe] = 0x00e0000e,
+    [(KERNBASE >> 20) + 0xf] = 0x00f0000e,
 };
@@ -0,0 +1,225 @@
+/*
+ * pmap_host: kern/pmap.c's physical page allocator and page tables,
+ * run as an ordinary Linux program.
+ *
+ *	pmap_host [-m MB] [-s seed] test [nops]
+ *		randomized operation sequences checked against a model;
+ *	pmap_host [-m MB] [-s seed] bench
+ *		ops/sec and ns/op at several memory occupancies.
+ *
+ * This file is the half built against the C library.  It maps the
+ * simulated physical memory where the kernel would see it, at
+ * KERNBASE, so that KADDR() and PADDR() work unchanged, and supplies
+ * what pmap.c needs from the rest of the kernel: the console, panic,
+ * the clock and the cache maintenance it does after page-table
+ * updates, which the host does not need.  The tests themselves are
+ * in pmap_test.c, built against the JOS headers; see host.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "host.h"
+
+#define KERNBASE	0xC0000000	// must match inc/memlayout.h
+#define MAXMEM		(1024 * 1024 * 1024)	// all that fits above KERNBASE
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE	0x100000
+#endif
+
+char bootstack[8 * 4096];
+
+static uint32_t memsize = 128 * 1024 * 1024;
+
+// --------------------------------------------------------------
+// What pmap.c calls in the rest of the kernel.
+// --------------------------------------------------------------
+
+int
+cprintf(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vprintf(fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+void
+_panic(const char *file, int line, const char *fmt, ...)
+{
+	va_list ap;
+
+	fflush(stdout);
+	va_start(ap, fmt);
+	fprintf(stderr, "kernel panic at %s:%d: ", file, line);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	abort();
+}
+
+void
+_warn(const char *file, int line, const char *fmt, ...)
+{
+	va_list ap;
+
+	fflush(stdout);
+	va_start(ap, fmt);
+	fprintf(stderr, "kernel warning at %s:%d: ", file, line);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+// kern/host/Makefrag renames the string functions pmap.c uses, whose
+// size_t is 32 bits, to these.
+void *
+host_memset(void *v, int c, uint32_t n)
+{
+	return memset(v, c, n);
+}
+
+void *
+host_memcpy(void *dst, const void *src, uint32_t n)
+{
+	return memcpy(dst, src, n);
+}
+
+void *
+host_memmove(void *dst, const void *src, uint32_t n)
+{
+	return memmove(dst, src, n);
+}
+
+int
+host_memcmp(const void *v1, const void *v2, uint32_t n)
+{
+	return memcmp(v1, v2, n);
+}
+
+void
+page_zero(void *pg)
+{
+	memset(pg, 0, 4096);
+}
+
+void
+page_copy(void *dst, const void *src)
+{
+	memcpy(dst, src, 4096);
+}
+
+uint64_t
+time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint32_t
+bootinfo_memsize(uint32_t pa)
+{
+	return memsize;
+}
+
+void
+boot_trace(const char *name)
+{
+}
+
+void
+bp_invalidate_all(void)
+{
+}
+
+void
+dcache_clean_range(const void *va, uint32_t len)
+{
+}
+
+// --------------------------------------------------------------
+// Simulated physical memory.
+// --------------------------------------------------------------
+
+// Physical memory [0, memsize) at KERNBASE, demand-zero like RAM
+// after boot.  The linker put the kernel's 'end' past the start of it
+// (see kern/host/Makefrag); [1MB, end) stands in for the kernel image
+// and holds pages[].
+static void
+map_memory(void)
+{
+	void *va = (void *) (uintptr_t) KERNBASE;
+
+	if (mmap(va, memsize, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE,
+		 -1, 0) != va) {
+		perror("pmap_host: mmap at KERNBASE");
+		exit(1);
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: pmap_host [-m MB] [-s seed] test [nops]\n"
+		"       pmap_host [-m MB] [-s seed] bench\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint32_t seed = 1, nops = 1000000;
+	unsigned long mb;
+	int c;
+
+	while ((c = getopt(argc, argv, "m:s:")) != -1) {
+		switch (c) {
+		case 'm':
+			mb = strtoul(optarg, NULL, 0);
+			if (mb < 16 || mb > MAXMEM / (1024 * 1024)) {
+				fprintf(stderr, "pmap_host: memory must be 16 to %d MB\n",
+					MAXMEM / (1024 * 1024));
+				exit(2);
+			}
+			memsize = mb * 1024 * 1024;
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1)
+		usage();
+
+	map_memory();
+	pmap_host_init(memsize);
+	if (strcmp(argv[0], "test") == 0 && argc <= 2) {
+		if (argc == 2)
+			nops = strtoul(argv[1], NULL, 0);
+		pmap_host_test(seed, nops);
+		return 0;
+	}
+	if (strcmp(argv[0], "bench") == 0 && argc == 1) {
+		pmap_host_bench(seed);
+		return 0;
+	}
+	usage();
+	return 2;
+}
@@ -0,0 +1,21 @@
+#ifndef JOS_KERN_HOST_HOST_H
+#define JOS_KERN_HOST_HOST_H
+
+// The two halves of the host pmap harness.  host.c is built against
+// the C library and pmap_test.c against the JOS headers, whose size_t
+// and pointer-sized types differ from the host's, so only uint32_t
+// and int cross between them.  Include after <stdint.h> or
+// <inc/types.h>.
+
+// Make [0, memsize) of simulated physical memory the kernel's, as
+// mem_init() would, and hand what is free to page_init().
+void	pmap_host_init(uint32_t memsize);
+
+// Random operation sequences checked against a model.  Panics on a
+// mismatch, naming the check and the operation.
+void	pmap_host_test(uint32_t seed, uint32_t nops);
+
+// Throughput of the allocator and the page-table operations.
+void	pmap_host_bench(uint32_t seed);
+
+#endif	// !JOS_KERN_HOST_HOST_H
@@ -0,0 +1,26 @@
+#ifndef JOS_INC_ARM_H
+#define JOS_INC_ARM_H
+
+// Stand-ins for inc/arm.h when kern/pmap.c is built for the host (see
+// kern/host/Makefrag, which puts this directory first on the include
+// path).  There is no MMU or TLB to program: coprocessor writes are
+// dropped and reads return zero.
+
+static inline void load_pgdir(uint32_t value) {}
+static inline void load_kern_pgdir(uint32_t value) {}
+static inline void write_ttbcr(uint32_t value) {}
+static inline void write_contextidr(uint32_t value) {}
+static inline uint32_t read_sctlr(void) { return 0; }
+static inline void write_sctlr(uint32_t val) {}
+static inline uint32_t read_dacr(void) { return 0; }
+static inline void write_dacr(uint32_t val) {}
+
+static inline void tlbimva(uint32_t mva_asid) {}
+static inline void tlbiasid(uint32_t asid) {}
+static inline void tlbiall(void) {}
+
+static inline void dsb(void) {}
+static inline void dmb(void) {}
+static inline void isb(void) {}
+
+#endif
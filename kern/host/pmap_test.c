@@ -0,0 +1,502 @@
+// Randomized tests and benchmarks of kern/pmap.c, run on the host by
+// host.c.  This half is built like the kernel, against the JOS
+// headers, so it uses the allocator and page tables as the kernel
+// does.
+//
+// The tests mix page allocations of every small order with page-table
+// operations on a few user page directories, and keep a model of what
+// should be allocated and mapped.  Every operation is checked as it
+// is done, the whole model every CHECK_EVERY operations, and at the
+// end, once everything is freed again, the free memory must be what
+// it was at the start, in blocks as large as at the start.
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/pmap.h>
+#include <kern/time.h>
+
+#include "host.h"
+
+#define MAXPAGES	(1024 * 1024 * 1024 / PGSIZE)
+
+#define NBLOCK		1024	// page blocks held at once
+#define MAXORDER	3	// largest block the tests allocate
+#define NDIR		4	// user page directories
+#define NSLOT		1024	// virtual pages the tests map, per directory
+#define NPOOL		64	// physical pages they map there
+#define CHECK_EVERY	4096
+
+// The tests map pages in [VA_BASE, VA_BASE + VA_SIZE), enough to
+// span many L2 tables while filling each with several entries.
+#define VA_BASE		0x10000000
+#define VA_SIZE		(64 * 1024 * 1024)
+
+static uint32_t rand_state;
+
+static uint32_t
+rand32(void)
+{
+	// xorshift32
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+static void
+rand_seed(uint32_t seed)
+{
+	rand_state = seed ? seed : 1;
+}
+
+void
+pmap_host_init(uint32_t memsize)
+{
+	extern char end[];
+
+	npages = memsize / PGSIZE;
+	pages = KADDR(0x100000);
+	if ((char *) (pages + npages) > end)
+		panic("pages[] for %u pages does not fit below end", npages);
+	page_init();
+}
+
+
+// --------------------------------------------------------------
+// Tests.
+// --------------------------------------------------------------
+
+static uint32_t test_op;	// operation being done, for failures
+static uint32_t test_seed;
+
+#define expect(x)							\
+	do {								\
+		if (!(x))						\
+			panic("seed %u, op %u: %s", test_seed, test_op, #x); \
+	} while (0)
+
+// Which pages the tests hold, to catch one handed out twice.
+static uint8_t page_held[MAXPAGES];
+
+static struct Block {
+	struct PageInfo *b_pp;
+	int b_order;
+} blocks[NBLOCK];
+static int nblocks;
+
+static struct PageInfo *pool[NPOOL];
+static pde_t *dirs[NDIR];
+static uintptr_t slot_va[NSLOT];
+// Pool page mapped at each slot of each directory, or -1, and how.
+static int16_t slot_page[NDIR][NSLOT];
+static uint8_t slot_rw[NDIR][NSLOT];
+
+// Each held page carries its own address in its first word; a page
+// also handed to someone else, or used for a page table, loses it.
+static uint32_t
+page_tag(struct PageInfo *pp)
+{
+	return page2pa(pp) ^ 0x5A5A5A5A;
+}
+
+static void
+hold(struct PageInfo *pp, int order)
+{
+	extern char end[];
+	size_t idx = pp - pages, i;
+
+	expect(idx < npages && idx % (1 << order) == 0);
+	for (i = idx; i < idx + (1 << order); i++) {
+		expect(i != 0);
+		expect(i < PGNUM(0x100000) || i >= PGNUM(PADDR(ROUNDUP((char *) end, PGSIZE))));
+		expect(!page_held[i]);
+		expect(pages[i].pp_ref == 0);
+		page_held[i] = 1;
+		*(uint32_t *) page2kva(&pages[i]) = page_tag(&pages[i]);
+	}
+}
+
+static void
+unhold(struct PageInfo *pp, int order)
+{
+	size_t idx = pp - pages, i;
+
+	for (i = idx; i < idx + (1 << order); i++) {
+		expect(page_held[i]);
+		expect(*(uint32_t *) page2kva(&pages[i]) == page_tag(&pages[i]));
+		page_held[i] = 0;
+	}
+}
+
+// Allocate every free block of 2^order pages, then free them again.
+// Returns how many there were.
+static uint32_t
+count_free(int order)
+{
+	struct PageInfo *head = NULL, *pp;
+	uint32_t n = 0;
+
+	while ((pp = page_alloc_order(order, 0))) {
+		hold(pp, order);
+		pp->pp_link = head;
+		head = pp;
+		n++;
+	}
+	while ((pp = head)) {
+		head = pp->pp_link;
+		unhold(pp, order);
+		page_free_order(pp, order);
+	}
+	return n;
+}
+
+static void
+op_alloc(void)
+{
+	struct PageInfo *pp;
+	int order = rand32() % (MAXORDER + 1), zero = rand32() % 4 == 0;
+	uint32_t *w;
+
+	if (nblocks == NBLOCK)
+		return;
+	if (!(pp = page_alloc_order(order, zero ? ALLOC_ZERO : 0)))
+		return;
+	for (int i = 0; i < (1 << order); i++) {
+		expect(!(pp[i].pp_flags & PP_FREE));
+		if (zero)
+			for (w = page2kva(&pp[i]); w < (uint32_t *) page2kva(&pp[i]) + PGSIZE / 4; w++)
+				expect(*w == 0);
+	}
+	hold(pp, order);
+	blocks[nblocks].b_pp = pp;
+	blocks[nblocks].b_order = order;
+	nblocks++;
+}
+
+static void
+op_free(void)
+{
+	struct Block *b;
+
+	if (nblocks == 0)
+		return;
+	b = &blocks[rand32() % nblocks];
+	unhold(b->b_pp, b->b_order);
+	// Scribble on it, as a careless user would.
+	memset(page2kva(b->b_pp), 0xA5, PGSIZE << b->b_order);
+	page_free_order(b->b_pp, b->b_order);
+	*b = blocks[--nblocks];
+}
+
+static void
+op_insert(void)
+{
+	int d = rand32() % NDIR, s = rand32() % NSLOT, p = rand32() % NPOOL;
+	int rw = rand32() % 2;
+
+	if (page_insert(dirs[d], pool[p], (void *) slot_va[s],
+			rw ? PTE_RW_U : PTE_R_U) < 0)
+		return;		// no memory for an L2 table; nothing changed
+	slot_page[d][s] = p;
+	slot_rw[d][s] = rw;
+}
+
+static void
+op_remove(void)
+{
+	int d = rand32() % NDIR, s = rand32() % NSLOT;
+
+	page_remove(dirs[d], (void *) slot_va[s]);
+	slot_page[d][s] = -1;
+}
+
+static void
+op_remove_range(void)
+{
+	int d = rand32() % NDIR, s = rand32() % NSLOT;
+	uintptr_t start = slot_va[s], len = (rand32() % 2048 + 1) * PGSIZE;
+
+	page_remove_range(dirs[d], (void *) start, len);
+	for (s = 0; s < NSLOT; s++)
+		if (slot_va[s] >= start && slot_va[s] < start + len)
+			slot_page[d][s] = -1;
+}
+
+static void
+check_slot(int d, int s)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+
+	pp = page_lookup(dirs[d], (void *) slot_va[s], &pte);
+	if (slot_page[d][s] < 0) {
+		expect(pp == NULL);
+		expect(pte == NULL || !(*pte & PTE_P));
+		expect(pte == pgdir_walk(dirs[d], (void *) slot_va[s], 0));
+		return;
+	}
+	expect(pp == pool[slot_page[d][s]]);
+	expect(pte && PTE_SMALL_ADDR(*pte) == page2pa(pp));
+	expect((*pte & PTE_RW_U) == (slot_rw[d][s] ? PTE_RW_U : PTE_R_U));
+	expect(*pte & PTE_NG);
+}
+
+static void
+op_lookup(void)
+{
+	check_slot(rand32() % NDIR, rand32() % NSLOT);
+}
+
+// Replace one directory by a copy of another.  Writable pages become
+// copy-on-write in both, which leaves their PTE_RW_U bits alone.
+static void
+op_dup(void)
+{
+	int d = rand32() % NDIR, e = rand32() % NDIR;
+	pde_t *dup;
+
+	if (d == e || !(dup = pgdir_dup(dirs[d])))
+		return;
+	pgdir_destroy(dirs[e]);
+	dirs[e] = dup;
+	memmove(slot_page[e], slot_page[d], sizeof(slot_page[e]));
+	memmove(slot_rw[e], slot_rw[d], sizeof(slot_rw[e]));
+}
+
+static void
+check_all(void)
+{
+	int refs[NPOOL];
+	int d, s, p;
+
+	for (p = 0; p < NPOOL; p++)
+		refs[p] = 1;	// the tests' own
+	for (d = 0; d < NDIR; d++)
+		for (s = 0; s < NSLOT; s++) {
+			check_slot(d, s);
+			if (slot_page[d][s] >= 0)
+				refs[slot_page[d][s]]++;
+		}
+	for (p = 0; p < NPOOL; p++) {
+		expect(pool[p]->pp_ref == refs[p]);
+		expect(*(uint32_t *) page2kva(pool[p]) == page_tag(pool[p]));
+	}
+	for (int b = 0; b < nblocks; b++)
+		for (int i = 0; i < (1 << blocks[b].b_order); i++)
+			expect(*(uint32_t *) page2kva(&blocks[b].b_pp[i])
+			       == page_tag(&blocks[b].b_pp[i]));
+}
+
+void
+pmap_host_test(uint32_t seed, uint32_t nops)
+{
+	uint32_t free0, big0, r;
+	int d, s, p;
+
+	rand_seed(seed);
+	test_seed = seed;
+	free0 = count_free(0);
+	big0 = count_free(PAGE_MAX_ORDER);
+	cprintf("pmap test: seed %u, %u ops, %u pages, %u free (%u of %uMB)\n",
+		seed, nops, npages, free0, big0, (PGSIZE << PAGE_MAX_ORDER) >> 20);
+
+	// Distinct, page-aligned and scattered.
+	for (s = 0; s < NSLOT; s++) {
+	again:
+		slot_va[s] = VA_BASE + rand32() % (VA_SIZE / PGSIZE) * PGSIZE;
+		for (int t = 0; t < s; t++)
+			if (slot_va[t] == slot_va[s])
+				goto again;
+	}
+	for (p = 0; p < NPOOL; p++) {
+		expect((pool[p] = page_alloc(0)) != NULL);
+		hold(pool[p], 0);
+		pool[p]->pp_ref++;
+	}
+	for (d = 0; d < NDIR; d++) {
+		expect((dirs[d] = pgdir_create()) != NULL);
+		for (s = 0; s < NSLOT; s++)
+			slot_page[d][s] = -1;
+	}
+
+	for (test_op = 0; test_op < nops; test_op++) {
+		r = rand32() % 100;
+		if (r < 20)
+			op_alloc();
+		else if (r < 40)
+			op_free();
+		else if (r < 65)
+			op_insert();
+		else if (r < 80)
+			op_remove();
+		else if (r < 98)
+			op_lookup();
+		else if (r < 99)
+			op_remove_range();
+		else
+			op_dup();
+		if (test_op % CHECK_EVERY == 0)
+			check_all();
+	}
+	check_all();
+
+	// Give everything back.  Destroying a directory drops the
+	// references its mappings hold and frees its page tables.
+	for (d = 0; d < NDIR; d++)
+		pgdir_destroy(dirs[d]);
+	for (p = 0; p < NPOOL; p++) {
+		expect(pool[p]->pp_ref == 1);
+		unhold(pool[p], 0);
+		page_decref(pool[p]);
+	}
+	while (nblocks > 0)
+		op_free();
+
+	expect(count_free(0) == free0);
+	expect(count_free(PAGE_MAX_ORDER) == big0);
+	cprintf("pmap test: passed\n");
+}
+
+
+// --------------------------------------------------------------
+// Benchmarks.
+// --------------------------------------------------------------
+
+#define BENCH_BATCH	256
+#define BENCH_ROUNDS	1024	// batches per measurement
+#define BENCH_NVA	4096	// pages mapped by the lookup benchmarks
+
+static struct PageInfo *occupied[MAXPAGES];
+static uint32_t noccupied;
+
+// Allocate 'pct' percent of free memory, as randomly chosen single
+// pages, so that what is left is fragmented the way a long-running
+// system's would be.  Returns the number of pages left free.
+static uint32_t
+occupy(int pct)
+{
+	struct PageInfo *pp;
+	uint32_t n, i, j;
+
+	while (noccupied > 0)
+		page_free(occupied[--noccupied]);
+	while ((pp = page_alloc(0)))
+		occupied[noccupied++] = pp;
+	n = noccupied;
+	for (i = n - 1; i > 0; i--) {
+		j = rand32() % (i + 1);
+		pp = occupied[i];
+		occupied[i] = occupied[j];
+		occupied[j] = pp;
+	}
+	while (noccupied > (uint64_t) n * pct / 100)
+		page_free(occupied[--noccupied]);
+	return n - noccupied;
+}
+
+static void
+bench_report(const char *name, uint32_t nops, uint64_t ns)
+{
+	if (ns == 0)
+		ns = 1;
+	cprintf("  %-16s %10llu ops/s %8llu.%llu ns/op\n", name,
+		(uint64_t) nops * NSEC_PER_SEC / ns,
+		ns / nops, ns * 10 / nops % 10);
+}
+
+static void
+bench_alloc(const char *name, int alloc_flags)
+{
+	struct PageInfo *batch[BENCH_BATCH];
+	uint64_t t0;
+	int r, i;
+
+	t0 = time_ns();
+	for (r = 0; r < BENCH_ROUNDS; r++) {
+		for (i = 0; i < BENCH_BATCH; i++)
+			if (!(batch[i] = page_alloc(alloc_flags)))
+				panic("bench: out of memory");
+		for (i = 0; i < BENCH_BATCH; i++)
+			page_free(batch[i]);
+	}
+	bench_report(name, BENCH_ROUNDS * BENCH_BATCH, time_ns() - t0);
+}
+
+// Map and unmap runs of pages, so that every batch also allocates and
+// frees its L2 tables.
+static void
+bench_insert_remove(pde_t *pgdir, struct PageInfo *pp)
+{
+	uintptr_t va;
+	uint64_t t0;
+	int r, i;
+
+	t0 = time_ns();
+	for (r = 0; r < BENCH_ROUNDS; r++) {
+		va = VA_BASE + (r % (VA_SIZE / (BENCH_BATCH * PGSIZE))) * BENCH_BATCH * PGSIZE;
+		for (i = 0; i < BENCH_BATCH; i++)
+			if (page_insert(pgdir, pp, (void *) (va + i * PGSIZE), PTE_RW_U) < 0)
+				panic("bench: out of memory");
+		for (i = 0; i < BENCH_BATCH; i++)
+			page_remove(pgdir, (void *) (va + i * PGSIZE));
+	}
+	bench_report("insert+remove", BENCH_ROUNDS * BENCH_BATCH, time_ns() - t0);
+}
+
+static void
+bench_lookup(pde_t *pgdir, struct PageInfo *pp)
+{
+	uint32_t n = BENCH_ROUNDS * BENCH_BATCH, i;
+	volatile uintptr_t sink = 0;
+	uint64_t t0;
+
+	for (i = 0; i < BENCH_NVA; i++)
+		if (page_insert(pgdir, pp, (void *) (VA_BASE + i * PGSIZE), PTE_RW_U) < 0)
+			panic("bench: out of memory");
+
+	t0 = time_ns();
+	for (i = 0; i < n; i++)
+		sink += (uintptr_t) page_lookup(pgdir,
+			(void *) (VA_BASE + i % BENCH_NVA * PGSIZE), NULL);
+	bench_report("lookup hit", n, time_ns() - t0);
+
+	// Past the mapped pages there are no L2 tables.
+	t0 = time_ns();
+	for (i = 0; i < n; i++)
+		sink += (uintptr_t) pgdir_walk(pgdir,
+			(void *) (VA_BASE + VA_SIZE + i % BENCH_NVA * PGSIZE), 0);
+	bench_report("walk miss", n, time_ns() - t0);
+
+	page_remove_range(pgdir, (void *) VA_BASE, BENCH_NVA * PGSIZE);
+}
+
+void
+pmap_host_bench(uint32_t seed)
+{
+	static const int levels[] = { 0, 50, 90, 98 };
+	struct PageInfo *pp;
+	pde_t *pgdir;
+	uint32_t nfree;
+
+	rand_seed(seed);
+	cprintf("pmap bench: %u pages, %u per batch\n", npages, BENCH_BATCH);
+	for (int l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+		nfree = occupy(levels[l]);
+		cprintf("%d%% occupied, %u pages free:\n", levels[l], nfree);
+		bench_alloc("alloc+free", 0);
+		bench_alloc("alloc zero+free", ALLOC_ZERO);
+
+		if (!(pp = page_alloc(0)) || !(pgdir = pgdir_create()))
+			panic("bench: out of memory");
+		pp->pp_ref++;
+		bench_insert_remove(pgdir, pp);
+		bench_lookup(pgdir, pp);
+		pgdir_destroy(pgdir);
+		page_decref(pp);
+	}
+	occupy(0);
+}
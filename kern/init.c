@@ -1,17 +1,40 @@
 #include <inc/stdio.h>
+#include <inc/string.h>
 #include <inc/memlayout.h>
+#include <inc/arm.h>
 
 #include <kern/pmap.h>
+#include <kern/slab.h>
+#include <kern/vm.h>
 #include <kern/monitor.h>
 #include <kern/console.h>
+#include <kern/trap.h>
+#include <kern/time.h>
+#include <kern/dmesg.h>
+#include <kern/boottime.h>
 
-void arm_init()
+// Called from entry.S with the registers the boot loader passed:
+// r0 is 0, r1 the machine type and r2 the physical address of the
+// ATAG list or device tree.
+void arm_init(uint32_t zero, uint32_t machid, physaddr_t bootinfo)
 {
     cons_init();
+    boot_trace("cons_init");
     cprintf("6828 decimal is %o octal!\n", 6828);
+    trap_init();
+    boot_trace("trap_init");
+    cons_irq_init();
+    boot_trace("cons_irq_init");
+    time_init();
+    boot_trace("time_init");
 
-    mem_init();
+    mem_init(bootinfo);
+    kmem_init();
+    boot_trace("kmem_init");
+    vm_init();
+    boot_trace("vm_init");
 
+    intr_enable();
     while (1)
 	monitor(NULL);
 }
@@ -30,19 +53,27 @@ const char *panicstr;
 _panic(const char *file, int line, const char *fmt,...)
 {
     va_list ap;
+    char buf[256];
 
     if (panicstr)
 	goto dead;
     panicstr = fmt;
 
     // Be extra sure that the machine is in as reasonable state
-    // __asm __volatile("cli; cld");
+    intr_disable();
 
+    // Flush the log first, then write the message straight to the
+    // console: the ring may be full, or stuck behind a record this
+    // panic interrupted the writing of.  With IRQs masked the console
+    // writes out synchronously.
+    dmesg_drain();
+    snprintf(buf, sizeof(buf), "kernel panic on CPU at %s:%d: ", file, line);
+    cons_write(buf, strlen(buf));
     va_start(ap, fmt);
-    cprintf("kernel panic on CPU at %s:%d: ", file, line);
-    vcprintf(fmt, ap);
-    cprintf("\n");
+    vsnprintf(buf, sizeof(buf), fmt, ap);
     va_end(ap);
+    cons_write(buf, strlen(buf));
+    cons_write("\n", 1);
 
 dead:
     /* break into the kernel monitor */
@@ -0,0 +1,120 @@
+// BCM2835 interrupt controller.
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+#include <inc/assert.h>
+#include <inc/stdio.h>
+
+#include <kern/irq.h>
+
+enum
+{
+    IC_BASE = MMIOBASE + 0xB200,
+
+    IC_BASIC_PENDING = (IC_BASE + 0x00),
+    IC_PENDING1      = (IC_BASE + 0x04),
+    IC_PENDING2      = (IC_BASE + 0x08),
+    IC_FIQ_CONTROL   = (IC_BASE + 0x0C),
+    IC_ENABLE1       = (IC_BASE + 0x10),
+    IC_ENABLE2       = (IC_BASE + 0x14),
+    IC_ENABLE_BASIC  = (IC_BASE + 0x18),
+    IC_DISABLE1      = (IC_BASE + 0x1C),
+    IC_DISABLE2      = (IC_BASE + 0x20),
+    IC_DISABLE_BASIC = (IC_BASE + 0x24),
+};
+
+static inline void mmio_write(uint32_t reg, uint32_t data)
+{
+	*(volatile uint32_t *)reg = data;
+}
+
+static inline uint32_t mmio_read(uint32_t reg)
+{
+	return *(volatile uint32_t *)reg;
+}
+
+struct IrqHandler {
+	irq_handler_t ih_func;
+	void *ih_arg;
+	uint32_t ih_count;		// times dispatched
+};
+
+static struct IrqHandler irq_handlers[NIRQ];
+
+// The enable and disable registers are write-one: writing a bit only
+// affects that line.  Line n lives in bit n%32 of register n/32; the
+// basic sources follow the two GPU registers.
+static uint32_t
+irq_reg(uint32_t reg1, int irq)
+{
+	return reg1 + 4 * (irq / 32);
+}
+
+void
+irq_init(void)
+{
+	mmio_write(IC_FIQ_CONTROL, 0);
+	mmio_write(IC_DISABLE1, ~0);
+	mmio_write(IC_DISABLE2, ~0);
+	mmio_write(IC_DISABLE_BASIC, ~0);
+}
+
+void
+irq_enable(int irq)
+{
+	assert(irq >= 0 && irq < NIRQ);
+	mmio_write(irq_reg(IC_ENABLE1, irq), 1 << (irq % 32));
+}
+
+void
+irq_disable(int irq)
+{
+	assert(irq >= 0 && irq < NIRQ);
+	mmio_write(irq_reg(IC_DISABLE1, irq), 1 << (irq % 32));
+}
+
+// Install func as the handler of line irq and unmask the line.
+void
+irq_register(int irq, irq_handler_t func, void *arg)
+{
+	assert(irq >= 0 && irq < NIRQ);
+	irq_handlers[irq].ih_func = func;
+	irq_handlers[irq].ih_arg = arg;
+	irq_enable(irq);
+}
+
+static void
+irq_run(struct Trapframe *tf, int irq)
+{
+	struct IrqHandler *ih = &irq_handlers[irq];
+
+	if (!ih->ih_func) {
+		// Nobody wants it; mask it so it cannot storm.
+		irq_disable(irq);
+		cprintf("spurious IRQ %d\n", irq);
+		return;
+	}
+	ih->ih_count++;
+	ih->ih_func(tf, ih->ih_arg);
+}
+
+// Run the handler of every pending line.  The pending1/pending2 flags
+// in the basic register leave out the lines it mirrors as shortcuts
+// (the UART among them), so both GPU registers are always read.
+void
+irq_dispatch(struct Trapframe *tf)
+{
+	uint32_t pending[3];
+	int i, bit;
+
+	pending[0] = mmio_read(IC_PENDING1);
+	pending[1] = mmio_read(IC_PENDING2);
+	pending[2] = mmio_read(IC_BASIC_PENDING) & 0xFF;
+
+	for (i = 0; i < 3; i++)
+		while (pending[i]) {
+			bit = __builtin_ctz(pending[i]);
+			pending[i] &= pending[i] - 1;
+			irq_run(tf, i * 32 + bit);
+		}
+}
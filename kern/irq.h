@@ -0,0 +1,25 @@
+#ifndef JOS_KERN_IRQ_H
+#define JOS_KERN_IRQ_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/trap.h>
+
+// Interrupt lines of the BCM2835 interrupt controller: 0-63 are the
+// GPU peripherals, 64-71 the ARM-side sources of the basic register.
+#define IRQ_TIMER1	1	// system timer compare 1
+#define IRQ_TIMER3	3	// system timer compare 3
+#define IRQ_UART	57	// PL011 UART0
+#define IRQ_ARM_TIMER	64	// ARM SP804 timer
+#define NIRQ		72
+
+typedef void (*irq_handler_t)(struct Trapframe *tf, void *arg);
+
+void	irq_init(void);
+void	irq_register(int irq, irq_handler_t func, void *arg);
+void	irq_enable(int irq);
+void	irq_disable(int irq);
+void	irq_dispatch(struct Trapframe *tf);
+
+#endif	// !JOS_KERN_IRQ_H
@@ -1,99 +1,43 @@
-#include <inc/stab.h>
 #include <inc/string.h>
 #include <inc/memlayout.h>
 #include <inc/assert.h>
 
 #include <kern/kdebug.h>
 
-extern const struct Stab __STAB_BEGIN__[];	// Beginning of stabs table
-extern const struct Stab __STAB_END__[];	// End of stabs table
-extern const char __STABSTR_BEGIN__[];		// Beginning of string table
-extern const char __STABSTR_END__[];		// End of string table
+extern const char __KSYMTAB_BEGIN__[];	// Beginning of the symbol table
+extern const char __KSYMTAB_END__[];	// End of the symbol table
+extern const char etext[];		// End of kernel text
 
+static const struct KsymHeader *ksym;
+static const struct KsymLine *ksym_lines;
+static const struct KsymFunc *ksym_funcs;
+static const uint32_t *ksym_files;
+static const char *ksym_strs;
 
-// stab_binsearch(stabs, region_left, region_right, type, addr)
-//
-//	Some stab types are arranged in increasing order by instruction
-//	address.  For example, N_FUN stabs (stab entries with n_type ==
-//	N_FUN), which mark functions, and N_SO stabs, which mark source files.
-//
-//	Given an instruction address, this function finds the single stab
-//	entry of type 'type' that contains that address.
-//
-//	The search takes place within the range [*region_left, *region_right].
-//	Thus, to search an entire set of N stabs, you might do:
-//
-//		left = 0;
-//		right = N - 1;     /* rightmost stab */
-//		stab_binsearch(stabs, &left, &right, type, addr);
-//
-//	The search modifies *region_left and *region_right to bracket the
-//	'addr'.  *region_left points to the matching stab that contains
-//	'addr', and *region_right points just before the next stab.  If
-//	*region_left > *region_right, then 'addr' is not contained in any
-//	matching stab.
-//
-//	For example, given these N_SO stabs:
-//		Index  Type   Address
-//		0      SO     f0100000
-//		13     SO     f0100040
-//		117    SO     f0100176
-//		118    SO     f0100178
-//		555    SO     f0100652
-//		556    SO     f0100654
-//		657    SO     f0100849
-//	this code:
-//		left = 0, right = 657;
-//		stab_binsearch(stabs, &left, &right, N_SO, 0xf0100184);
-//	will exit setting left = 118, right = 554.
-//
-static void
-stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
-	       int type, uintptr_t addr)
+// Find the parts of the table, once.  Returns 0 if the table is
+// usable, and negative if it is missing or belongs to another build.
+static int
+ksym_init(void)
 {
-	int l = *region_left, r = *region_right, any_matches = 0;
-
-	while (l <= r) {
-		int true_m = (l + r) / 2, m = true_m;
-
-		// search for earliest stab with right type
-		while (m >= l && stabs[m].n_type != type)
-			m--;
-		if (m < l) {	// no match in [l, m]
-			l = true_m + 1;
-			continue;
-		}
-
-		// actual binary search
-		any_matches = 1;
-		if (stabs[m].n_value < addr) {
-			*region_left = m;
-			l = true_m + 1;
-		} else if (stabs[m].n_value > addr) {
-			*region_right = m - 1;
-			r = m - 1;
-		} else {
-			// exact match for 'addr', but continue loop to find
-			// *region_right
-			*region_left = m;
-			l = m;
-			addr++;
-		}
-	}
+	const struct KsymHeader *h = (const struct KsymHeader *) __KSYMTAB_BEGIN__;
+	size_t size = __KSYMTAB_END__ - __KSYMTAB_BEGIN__;
+
+	if (ksym)
+		return 0;
+	// The first link of the kernel, which the table is built from,
+	// has an empty section.
+	if (size < sizeof(*h) || h->kh_magic != KSYM_MAGIC
+	    || h->kh_etext != (uintptr_t) etext || h->kh_nline == 0)
+		return -1;
 
-	if (!any_matches)
-		*region_right = *region_left - 1;
-	else {
-		// find rightmost region containing 'addr'
-		for (l = *region_right;
-		     l > *region_left && stabs[l].n_type != type;
-		     l--)
-			/* do nothing */;
-		*region_left = l;
-	}
+	ksym_lines = (const struct KsymLine *) (h + 1);
+	ksym_funcs = (const struct KsymFunc *) (ksym_lines + h->kh_nline);
+	ksym_files = (const uint32_t *) (ksym_funcs + h->kh_nfunc);
+	ksym_strs = (const char *) (ksym_files + h->kh_nfile);
+	ksym = h;
+	return 0;
 }
 
-
 // debuginfo_eip(addr, info)
 //
 //	Fill in the 'info' structure with information about the specified
@@ -101,12 +45,16 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
 //	negative if not.  But even if it returns negative it has stored some
 //	information into '*info'.
 //
+//	This is one binary search of the table for the last record at or
+//	below 'addr'; the record leads straight to the function and
+//	file names.
+//
 int
 debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 {
-	const struct Stab *stabs, *stab_end;
-	const char *stabstr, *stabstr_end;
-	int lfile, rfile, lfun, rfun, lline, rline;
+	const struct KsymLine *kl;
+	const struct KsymFunc *kf;
+	int l, r, m;
 
 	// Initialize *info
 	info->eip_file = "<unknown>";
@@ -116,91 +64,31 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 	info->eip_fn_addr = addr;
 	info->eip_fn_narg = 0;
 
-	// Find the relevant set of stabs
-	//if (addr >= ULIM) {
-		stabs = __STAB_BEGIN__;
-		stab_end = __STAB_END__;
-		stabstr = __STABSTR_BEGIN__;
-		stabstr_end = __STABSTR_END__;
-	//} else {
-		// Can't search for user-level addresses yet!
-  	//        panic("User address");
-	//}
-
-	// String table validity checks
-	if (stabstr_end <= stabstr || stabstr_end[-1] != 0)
+	if (ksym_init() < 0)
 		return -1;
-
-	// Now we find the right stabs that define the function containing
-	// 'eip'.  First, we find the basic source file containing 'eip'.
-	// Then, we look in that source file for the function.  Then we look
-	// for the line number.
-
-	// Search the entire set of stabs for the source file (type N_SO).
-	lfile = 0;
-	rfile = (stab_end - stabs) - 1;
-	stab_binsearch(stabs, &lfile, &rfile, N_SO, addr);
-	if (lfile == 0)
+	if (addr < ksym_lines[0].kl_addr || addr >= ksym->kh_etext)
 		return -1;
 
-	// Search within that file's stabs for the function definition
-	// (N_FUN).
-	lfun = lfile;
-	rfun = rfile;
-	stab_binsearch(stabs, &lfun, &rfun, N_FUN, addr);
-
-	if (lfun <= rfun) {
-		// stabs[lfun] points to the function name
-		// in the string table, but check bounds just in case.
-		if (stabs[lfun].n_strx < stabstr_end - stabstr)
-			info->eip_fn_name = stabstr + stabs[lfun].n_strx;
-		info->eip_fn_addr = stabs[lfun].n_value;
-		addr -= info->eip_fn_addr;
-		// Search within the function definition for the line number.
-		lline = lfun;
-		rline = rfun;
-	} else {
-		// Couldn't find function stab!  Maybe we're in an assembly
-		// file.  Search the whole file for the line number.
-		info->eip_fn_addr = addr;
-		lline = lfile;
-		rline = rfile;
+	// Invariant: ksym_lines[l].kl_addr <= addr, and every record
+	// past r starts above addr.
+	l = 0;
+	r = ksym->kh_nline - 1;
+	while (l < r) {
+		m = (l + r + 1) / 2;
+		if (ksym_lines[m].kl_addr <= addr)
+			l = m;
+		else
+			r = m - 1;
+	}
+	kl = &ksym_lines[l];
+
+	kf = &ksym_funcs[kl->kl_func];
+	info->eip_fn_name = ksym_strs + kf->kf_name;
+	info->eip_fn_namelen = strlen(info->eip_fn_name);
+	info->eip_fn_addr = kf->kf_addr;
+	if (kl->kl_file != KSYM_NOFILE) {
+		info->eip_file = ksym_strs + ksym_files[kl->kl_file];
+		info->eip_line = kl->kl_line;
 	}
-	// Ignore stuff after the colon.
-	info->eip_fn_namelen = strfind(info->eip_fn_name, ':') - info->eip_fn_name;
-
-
-	// Search within [lline, rline] for the line number stab.
-	// If found, set info->eip_line to the right line number.
-	// If not found, return -1.
-	//
-	// Hint:
-	//	There's a particular stabs type used for line numbers.
-	//	Look at the STABS documentation and <inc/stab.h> to find
-	//	which one.
-	// Your code here.
-
-
-	// Search backwards from the line number for the relevant filename
-	// stab.
-	// We can't just use the "lfile" stab because inlined functions
-	// can interpolate code from a different file!
-	// Such included source files use the N_SOL stab type.
-	while (lline >= lfile
-	       && stabs[lline].n_type != N_SOL
-	       && (stabs[lline].n_type != N_SO || !stabs[lline].n_value))
-		lline--;
-	if (lline >= lfile && stabs[lline].n_strx < stabstr_end - stabstr)
-		info->eip_file = stabstr + stabs[lline].n_strx;
-
-
-	// Set eip_fn_narg to the number of arguments taken by the function,
-	// or 0 if there was no containing function.
-	if (lfun < rfun)
-		for (lline = lfun + 1;
-		     lline < rfun && stabs[lline].n_type == N_PSYM;
-		     lline++)
-			info->eip_fn_narg++;
-
 	return 0;
 }
@@ -17,4 +17,33 @@ struct Eipdebuginfo {
 
 int debuginfo_eip(uintptr_t eip, struct Eipdebuginfo *info);
 
+// The kernel's address-to-line table, generated at build time by
+// kern/mksymtab.c from the first link of the kernel and placed in the
+// .ksymtab section by the second.  A header is followed by kh_nline
+// KsymLine records sorted by address, kh_nfunc KsymFunc records, then
+// kh_nfile string offsets for the source file names, then the strings.
+#define KSYM_MAGIC	0x4B53594D	// "KSYM"
+#define KSYM_NOFILE	0xFFFF		// kl_file when the line is unknown
+
+struct KsymHeader {
+	uint32_t kh_magic;
+	uintptr_t kh_etext;		// etext of the kernel it describes
+	uint32_t kh_nline;
+	uint32_t kh_nfunc;
+	uint32_t kh_nfile;
+};
+
+// Instructions from kl_addr up to the next record's kl_addr.
+struct KsymLine {
+	uintptr_t kl_addr;
+	uint16_t kl_func;		// index into the KsymFunc records
+	uint16_t kl_file;		// index into the file name offsets
+	uint32_t kl_line;
+};
+
+struct KsymFunc {
+	uintptr_t kf_addr;
+	uint32_t kf_name;		// string offset
+};
+
 #endif
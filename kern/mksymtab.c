@@ -0,0 +1,254 @@
+/*
+ * mksymtab: build the kernel's address-to-line table.
+ *
+ * Runs on the build host, in two steps over the first link of the
+ * kernel (see kern/Makefrag):
+ *
+ *	mksymtab -a kernel.sym
+ *		prints every instruction address in the kernel text, one
+ *		per line, for addr2line to resolve;
+ *	mksymtab kernel.sym kernel.lines
+ *		reads those results back and writes the table as assembly.
+ *
+ * kernel.sym is 'nm -n' output.  Because addr2line reads whatever
+ * debugging format the kernel was compiled with, the table comes out
+ * the same for DWARF and for stabs.
+ *
+ * Runs of instructions with the same function, file and line become
+ * one record; the layout is described with struct KsymHeader in
+ * kern/kdebug.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#define KSYM_MAGIC	0x4B53594D	// must match kern/kdebug.h
+#define KSYM_NOFILE	0xFFFF
+
+struct Func {
+	unsigned addr;
+	unsigned name;		// string table offset
+};
+
+struct Line {
+	unsigned addr;
+	unsigned func;
+	unsigned file;
+	unsigned line;
+};
+
+static struct Func *funcs;
+static int nfunc;
+static unsigned text_start, text_end;
+
+static struct Line *lines;
+static int nline;
+
+static unsigned *files;		// string table offsets
+static int nfile;
+
+static char *strtab;
+static unsigned strsize, strcap;
+
+static char cwd[PATH_MAX];
+
+static void
+die(const char *msg, const char *arg)
+{
+	fprintf(stderr, "mksymtab: %s%s%s\n", msg, arg ? ": " : "",
+		arg ? arg : "");
+	exit(1);
+}
+
+static void *
+grow(void *p, int n, size_t size)
+{
+	// Double whenever n reaches a power of two.
+	if (n == 0 || (n & (n - 1)) == 0)
+		if (!(p = realloc(p, (n ? 2 * n : 16) * size)))
+			die("out of memory", NULL);
+	return p;
+}
+
+static unsigned
+addstr(const char *s)
+{
+	size_t len = strlen(s) + 1;
+	unsigned off;
+
+	while (strsize + len > strcap) {
+		strcap = strcap ? 2 * strcap : 4096;
+		if (!(strtab = realloc(strtab, strcap)))
+			die("out of memory", NULL);
+	}
+	off = strsize;
+	memcpy(strtab + off, s, len);
+	strsize += len;
+	return off;
+}
+
+// Read the text symbols from 'nm -n' output, keeping one name per
+// address.  The text runs from the first of them to etext.
+static void
+read_syms(const char *path)
+{
+	char buf[512], name[256];
+	unsigned addr;
+	char type;
+	FILE *f;
+
+	if (!(f = fopen(path, "r")))
+		die("cannot open", path);
+	while (fgets(buf, sizeof(buf), f)) {
+		if (sscanf(buf, "%x %c %255s", &addr, &type, name) != 3)
+			continue;
+		if (strcmp(name, "etext") == 0) {
+			text_end = addr;
+			continue;
+		}
+		// Skip data and the ARM mapping symbols ($a, $d).
+		if ((type != 't' && type != 'T') || name[0] == '$')
+			continue;
+		if (nfunc > 0 && funcs[nfunc - 1].addr == addr)
+			continue;
+		funcs = grow(funcs, nfunc, sizeof(*funcs));
+		funcs[nfunc].addr = addr;
+		funcs[nfunc].name = addstr(name);
+		nfunc++;
+	}
+	fclose(f);
+	if (nfunc == 0 || text_end == 0)
+		die("no text symbols or no etext in", path);
+	text_start = funcs[0].addr;
+}
+
+static unsigned
+file_index(const char *path)
+{
+	size_t n = strlen(cwd);
+	int i;
+
+	// Print paths relative to the top of the tree, as stabs did.
+	if (n > 0 && strncmp(path, cwd, n) == 0 && path[n] == '/')
+		path += n + 1;
+	for (i = nfile - 1; i >= 0; i--)
+		if (strcmp(strtab + files[i], path) == 0)
+			return i;
+	if (nfile == KSYM_NOFILE)
+		die("too many source files", NULL);
+	files = grow(files, nfile, sizeof(*files));
+	files[nfile] = addstr(path);
+	return nfile++;
+}
+
+// Read one addr2line result ("file:line", "file:line (discriminator
+// n)" or "??:0") per instruction.
+static void
+read_lines(const char *path)
+{
+	char buf[PATH_MAX + 64], *colon, *p;
+	unsigned addr, file, line;
+	int f = 0;
+	FILE *fp;
+
+	if (!(fp = fopen(path, "r")))
+		die("cannot open", path);
+	for (addr = text_start; addr < text_end; addr += 4) {
+		if (!fgets(buf, sizeof(buf), fp))
+			die("too few lines in", path);
+		if ((p = strstr(buf, " (")))
+			*p = '\0';
+		buf[strcspn(buf, "\n")] = '\0';
+
+		file = KSYM_NOFILE;
+		line = 0;
+		if ((colon = strrchr(buf, ':')) && strncmp(buf, "??", 2) != 0) {
+			*colon = '\0';
+			line = strtoul(colon + 1, NULL, 10);
+			file = file_index(buf);
+		}
+
+		while (f + 1 < nfunc && funcs[f + 1].addr <= addr)
+			f++;
+		if (nline > 0 && lines[nline - 1].func == f
+		    && lines[nline - 1].file == file
+		    && lines[nline - 1].line == line)
+			continue;
+		lines = grow(lines, nline, sizeof(*lines));
+		lines[nline].addr = addr;
+		lines[nline].func = f;
+		lines[nline].file = file;
+		lines[nline].line = line;
+		nline++;
+	}
+	fclose(fp);
+	if (nfunc > 0xFFFF)
+		die("too many functions", NULL);
+}
+
+// A string as an assembler .asciz directive.  Names and paths come
+// from nm and addr2line and may hold anything, so quotes, backslashes
+// and unprintable bytes are escaped.
+static void
+write_asciz(const char *s)
+{
+	printf("\t.asciz \"");
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if (*s < ' ' || *s > '~')
+			printf("\\%03o", (unsigned char) *s);
+		else
+			putchar(*s);
+	}
+	printf("\"\n");
+}
+
+static void
+write_table(void)
+{
+	unsigned i;
+
+	printf("// Generated by kern/mksymtab.c; do not edit.\n");
+	printf("\t.section .ksymtab, \"a\"\n");
+	printf("\t.p2align 2\n");
+	printf("\t.4byte 0x%08x, 0x%08x, %d, %d, %d\n",
+	       KSYM_MAGIC, text_end, nline, nfunc, nfile);
+	for (i = 0; i < nline; i++)
+		printf("\t.4byte 0x%08x\n\t.2byte %u, %u\n\t.4byte %u\n",
+		       lines[i].addr, lines[i].func, lines[i].file,
+		       lines[i].line);
+	for (i = 0; i < nfunc; i++)
+		printf("\t.4byte 0x%08x, %u\n", funcs[i].addr, funcs[i].name);
+	for (i = 0; i < nfile; i++)
+		printf("\t.4byte %u\n", files[i]);
+	for (i = 0; i < strsize; i += strlen(strtab + i) + 1)
+		write_asciz(strtab + i);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned addr;
+
+	if (argc == 3 && strcmp(argv[1], "-a") == 0) {
+		read_syms(argv[2]);
+		for (addr = text_start; addr < text_end; addr += 4)
+			printf("0x%08x\n", addr);
+		return 0;
+	}
+	if (argc != 3) {
+		fprintf(stderr, "usage: mksymtab -a kernel.sym\n"
+			"       mksymtab kernel.sym kernel.lines\n");
+		exit(2);
+	}
+	if (!getcwd(cwd, sizeof(cwd)))
+		cwd[0] = '\0';
+	read_syms(argv[1]);
+	read_lines(argv[2]);
+	write_table();
+	return 0;
+}
@@ -10,6 +10,9 @@
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/slab.h>
+#include <kern/dmesg.h>
+#include <kern/boottime.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -25,6 +28,12 @@ static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
 	{ "backtrace", "Display the call stack backtrace", mon_backtrace }, 
+	{ "slabinfo", "Display object cache usage", mon_slabinfo },
+	{ "dmesg", "Display and clear the kernel log", mon_dmesg },
+	{ "bench", "Run kernel microbenchmarks", mon_bench },
+	{ "perf", "Sample where the kernel spends its time", mon_perf },
+	{ "pmu", "Count hardware events over a command", mon_pmu },
+	{ "boottime", "Display the boot timeline", mon_boottime },
 };
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
@@ -92,6 +101,34 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 	return 0;
 }
 
+int
+mon_slabinfo(int argc, char **argv, struct Trapframe *tf)
+{
+	struct KmemCache *kc;
+	uint32_t bytes, used;
+
+	// util is the share of slab memory holding live object data;
+	// the rest is headers, padding and free objects.
+	cprintf("cache             size stride active  total slabs order util\n");
+	for (kc = kmem_caches; kc; kc = kc->kc_next) {
+		bytes = kc->kc_nslabs * (PGSIZE << kc->kc_order);
+		used = kc->kc_inuse * kc->kc_objsize;
+		cprintf("%-16s %5u  %5u %6u %6u %5u %5d %3u%%\n",
+			kc->kc_name, kc->kc_objsize, kc->kc_size,
+			kc->kc_inuse, kc->kc_nslabs * kc->kc_perslab,
+			kc->kc_nslabs, kc->kc_order,
+			bytes ? used / (bytes / 100) : 0);
+	}
+	return 0;
+}
+
+int
+mon_dmesg(int argc, char **argv, struct Trapframe *tf)
+{
+	dmesg_dump();
+	dmesg_clear();
+	return 0;
+}
 
 
 /***** Kernel monitor command interpreter *****/
@@ -104,7 +141,6 @@ runcmd(char *buf, struct Trapframe *tf)
 {
 	int argc;
 	char *argv[MAXARGS];
-	int i;
 
 	// Parse the command buffer into whitespace-separated arguments
 	argc = 0;
@@ -127,6 +163,16 @@ runcmd(char *buf, struct Trapframe *tf)
 	}
 	argv[argc] = 0;
 
+	return monitor_exec(argc, argv, tf);
+}
+
+// Run the already-parsed command argv[0], as if typed at the prompt;
+// for commands, like perf, that wrap another command.
+int
+monitor_exec(int argc, char **argv, struct Trapframe *tf)
+{
+	int i;
+
 	// Lookup and invoke the command
 	if (argc == 0)
 		return 0;
@@ -143,6 +189,7 @@ monitor(struct Trapframe *tf)
 {
 	char *buf;
 
+	boot_trace_end("monitor");
 	cprintf("Welcome to the JOS kernel monitor!\n");
 	cprintf("Type 'help' for a list of commands.\n");
 
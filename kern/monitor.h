@@ -10,10 +10,17 @@ struct Trapframe;
 // optionally providing a trap frame indicating the current state
 // (NULL if none).
 void monitor(struct Trapframe *tf);
+int monitor_exec(int argc, char **argv, struct Trapframe *tf);
 
 // Functions implementing monitor commands.
 int mon_help(int argc, char **argv, struct Trapframe *tf);
 int mon_kerninfo(int argc, char **argv, struct Trapframe *tf);
 int mon_backtrace(int argc, char **argv, struct Trapframe *tf);
+int mon_slabinfo(int argc, char **argv, struct Trapframe *tf);
+int mon_dmesg(int argc, char **argv, struct Trapframe *tf);
+int mon_bench(int argc, char **argv, struct Trapframe *tf);
+int mon_perf(int argc, char **argv, struct Trapframe *tf);
+int mon_pmu(int argc, char **argv, struct Trapframe *tf);
+int mon_boottime(int argc, char **argv, struct Trapframe *tf);
 
 #endif	// !JOS_KERN_MONITOR_H
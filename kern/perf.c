@@ -0,0 +1,261 @@
+// Sampling profiler, run from the monitor with "perf".
+//
+// A periodic timer interrupt records the pc it interrupted into a
+// preallocated buffer; nothing else happens per sample, so the cost
+// is the interrupt itself.  Symbolizing is left until the report,
+// which sorts the samples by address and looks each distinct one up
+// once with debuginfo_eip().
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/error.h>
+#include <inc/trap.h>
+
+#include <kern/monitor.h>
+#include <kern/kdebug.h>
+#include <kern/time.h>
+
+#define PERF_NSAMPLE	16384	// samples kept per run
+#define PERF_NSYM	1024	// distinct functions or lines per report
+#define PERF_HZ		1000	// default sampling rate
+#define PERF_MAXHZ	20000
+#define PERF_TOPN	10	// default report length
+
+// Samples of the current or last run, in the order taken until the
+// report sorts them.
+static struct {
+	uintptr_t pc[PERF_NSAMPLE];
+	uint32_t nsample;
+	uint32_t ndropped;	// samples that found the buffer full
+	bool running;
+	bool sorted;
+	uint32_t hz;
+	uint64_t start, stop;	// time_ns() of the run
+} perf;
+
+// A function or source line and its sample count, for the report.
+struct PerfSym {
+	const char *ps_name;
+	int ps_namelen;
+	const char *ps_file;
+	int ps_line;
+	uint32_t ps_count;
+};
+
+static struct PerfSym perf_funcs[PERF_NSYM];
+static struct PerfSym perf_lines[PERF_NSYM];
+
+static void
+perf_sample(struct Trapframe *tf, void *arg)
+{
+	if (perf.nsample < PERF_NSAMPLE)
+		perf.pc[perf.nsample++] = tf->tf_pc;
+	else
+		perf.ndropped++;
+}
+
+static int
+perf_start(uint32_t hz)
+{
+	int r;
+
+	perf.nsample = perf.ndropped = 0;
+	perf.sorted = 0;
+	perf.hz = hz;
+	perf.start = perf.stop = time_ns();
+	if ((r = time_start_periodic(NSEC_PER_SEC / hz, perf_sample, NULL)) < 0)
+		return r;
+	perf.running = 1;
+	return 0;
+}
+
+static void
+perf_stop(void)
+{
+	if (!perf.running)
+		return;
+	time_stop_periodic();
+	perf.stop = time_ns();
+	perf.running = 0;
+}
+
+// Shell sort the samples by address, so that each function's samples,
+// and each instruction's, end up next to each other.
+static void
+perf_sort(void)
+{
+	uint32_t n = perf.nsample, gap, i, j;
+	uintptr_t v;
+
+	if (perf.sorted)
+		return;
+	for (gap = 1; gap < n / 3; gap = gap * 3 + 1)
+		/* do nothing */;
+	for (; gap > 0; gap /= 3)
+		for (i = gap; i < n; i++) {
+			v = perf.pc[i];
+			for (j = i; j >= gap && perf.pc[j - gap] > v; j -= gap)
+				perf.pc[j] = perf.pc[j - gap];
+			perf.pc[j] = v;
+		}
+	perf.sorted = 1;
+}
+
+// Add 'count' samples at a pc described by 'info' to 'syms', which
+// holds '*nsyms' entries.  Functions are matched by name, lines by
+// file and line.  Returns -E_NO_MEM when the table is full.
+static int
+perf_add(struct PerfSym *syms, int *nsyms, const struct Eipdebuginfo *info,
+	 bool by_line, uint32_t count)
+{
+	struct PerfSym *ps;
+	int i;
+
+	for (i = *nsyms - 1; i >= 0; i--) {
+		ps = &syms[i];
+		if (ps->ps_name == info->eip_fn_name
+		    && (!by_line || (ps->ps_file == info->eip_file
+				     && ps->ps_line == info->eip_line))) {
+			ps->ps_count += count;
+			return 0;
+		}
+	}
+	if (*nsyms == PERF_NSYM)
+		return -E_NO_MEM;
+	ps = &syms[(*nsyms)++];
+	ps->ps_name = info->eip_fn_name;
+	ps->ps_namelen = info->eip_fn_namelen;
+	ps->ps_file = info->eip_file;
+	ps->ps_line = info->eip_line;
+	ps->ps_count = count;
+	return 0;
+}
+
+// Print the 'topn' entries of 'syms' with the most samples, in order.
+// Destroys the counts.
+static void
+perf_print_top(struct PerfSym *syms, int nsyms, int topn, bool by_line)
+{
+	struct PerfSym *best;
+	uint32_t pct;
+	int i, k;
+
+	for (k = 0; k < topn; k++) {
+		best = NULL;
+		for (i = 0; i < nsyms; i++)
+			if (syms[i].ps_count && (!best || syms[i].ps_count > best->ps_count))
+				best = &syms[i];
+		if (!best)
+			break;
+		pct = (uint64_t) best->ps_count * 1000 / perf.nsample;
+		cprintf("  %3u.%u%% %7u  %.*s", pct / 10, pct % 10,
+			best->ps_count, best->ps_namelen, best->ps_name);
+		if (by_line)
+			cprintf("  %s:%d", best->ps_file, best->ps_line);
+		cprintf("\n");
+		best->ps_count = 0;
+	}
+}
+
+static void
+perf_report(int topn)
+{
+	struct Eipdebuginfo info;
+	int nfuncs = 0, nlines = 0;
+	uint32_t i, j, ms, lost = 0;
+
+	perf_sort();
+	ms = (perf.stop - perf.start) / (NSEC_PER_SEC / 1000);
+	cprintf("%u samples at %u Hz over %u ms, %u dropped\n",
+		perf.nsample, perf.hz, ms, perf.ndropped);
+	if (perf.nsample == 0)
+		return;
+
+	// One lookup for each run of equal addresses.
+	for (i = 0; i < perf.nsample; i = j) {
+		for (j = i + 1; j < perf.nsample && perf.pc[j] == perf.pc[i]; j++)
+			/* do nothing */;
+		debuginfo_eip(perf.pc[i], &info);
+		if (perf_add(perf_funcs, &nfuncs, &info, 0, j - i) < 0)
+			lost += j - i;
+		perf_add(perf_lines, &nlines, &info, 1, j - i);
+	}
+	if (lost)
+		cprintf("%u samples in functions past the first %d\n",
+			lost, PERF_NSYM);
+
+	cprintf("Functions:\n");
+	perf_print_top(perf_funcs, nfuncs, topn, 0);
+	cprintf("Lines:\n");
+	perf_print_top(perf_lines, nlines, topn, 1);
+}
+
+// One "address count" line per sampled address, for tools on the
+// host to symbolize and fold.
+static void
+perf_dump(void)
+{
+	uint32_t i, j;
+
+	perf_sort();
+	for (i = 0; i < perf.nsample; i = j) {
+		for (j = i + 1; j < perf.nsample && perf.pc[j] == perf.pc[i]; j++)
+			/* do nothing */;
+		cprintf("%08x %u\n", perf.pc[i], j - i);
+	}
+}
+
+static uint32_t
+perf_hz(const char *arg)
+{
+	long hz = arg ? strtol(arg, NULL, 0) : PERF_HZ;
+
+	if (hz <= 0 || hz > PERF_MAXHZ) {
+		cprintf("rate must be 1 to %d Hz\n", PERF_MAXHZ);
+		return 0;
+	}
+	return hz;
+}
+
+int
+mon_perf(int argc, char **argv, struct Trapframe *tf)
+{
+	uint32_t hz;
+	int r;
+
+	if (argc >= 2 && strcmp(argv[1], "start") == 0) {
+		perf_stop();
+		if (!(hz = perf_hz(argc >= 3 ? argv[2] : NULL)))
+			return 0;
+		if ((r = perf_start(hz)) < 0)
+			cprintf("perf: cannot start the timer: %e\n", r);
+	} else if (argc >= 2 && strcmp(argv[1], "stop") == 0) {
+		perf_stop();
+		perf_report(PERF_TOPN);
+	} else if (argc >= 2 && strcmp(argv[1], "report") == 0) {
+		perf_stop();
+		perf_report(argc >= 3 ? strtol(argv[2], NULL, 0) : PERF_TOPN);
+	} else if (argc >= 2 && strcmp(argv[1], "dump") == 0) {
+		perf_stop();
+		perf_dump();
+	} else if (argc >= 3 && strcmp(argv[1], "run") == 0) {
+		perf_stop();
+		if ((r = perf_start(PERF_HZ)) < 0) {
+			cprintf("perf: cannot start the timer: %e\n", r);
+			return 0;
+		}
+		r = monitor_exec(argc - 2, argv + 2, tf);
+		perf_stop();
+		perf_report(PERF_TOPN);
+		return r;
+	} else {
+		cprintf("usage: perf start [hz]   sample at hz (default %d)\n"
+			"       perf stop         stop, and report\n"
+			"       perf report [n]   top n functions and lines\n"
+			"       perf dump         address and count per sampled pc\n"
+			"       perf run <cmd...> sample one monitor command\n",
+			PERF_HZ);
+	}
+	return 0;
+}
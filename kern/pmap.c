@@ -8,15 +8,48 @@
 #include <inc/assert.h>
 
 #include <kern/pmap.h>
+#include <kern/cache.h>
+#include <kern/bootinfo.h>
+#include <kern/time.h>
+#include <kern/boottime.h>
 
 pde_t kern_pgdir[4096] __attribute__((aligned(16 * 1024)));
 
-#define TOTAL_PHYS_MEM (256 * 1024 * 1024) // 256MB
-#define NPAGES (TOTAL_PHYS_MEM / PGSIZE)
-
-struct PageInfo pages[NPAGES];
-static struct PageInfo *page_free_list;
-size_t npages = NPAGES;
+// Assumed if the boot loader tells us nothing about memory.
+#define DEFAULT_PHYS_MEM (256 * 1024 * 1024) // 256MB
+
+// Physical address of the BCM2836 peripherals; RAM cannot extend past it.
+#define PERIPH_PHYS 0x3F000000
+
+struct PageInfo *pages;		// Physical page state array
+size_t npages;			// Amount of physical memory (in pages)
+
+// Free physical memory is kept by a binary buddy allocator.  A free
+// block of 2^order pages starts at a page whose number is a multiple of
+// 2^order.  The block's first PageInfo has PP_FREE set, records the
+// order, and is linked on page_free_lists[order].
+static struct PageInfo *page_free_lists[PAGE_MAX_ORDER + 1];
+
+// page_init() does not hand free memory to the buddy allocator page by
+// page.  It only records free extents, and page_alloc_order() carves
+// blocks off the front of an extent when the free lists run dry.  Pages
+// in [pe_start, pe_carved) belong to the buddy allocator.  Pages in
+// [pe_carved, pe_end) have not been touched yet, and neither have their
+// PageInfo structures.
+#define NEXTENTS 8
+
+static struct PageExtent {
+    size_t pe_start;		// page numbers
+    size_t pe_carved;
+    size_t pe_end;
+} page_extents[NEXTENTS];
+static int npage_extents;
+
+// Free memory taken away from the allocator by the checks.
+struct FreeStash {
+    struct PageInfo *fs_lists[PAGE_MAX_ORDER + 1];
+    size_t fs_end[NEXTENTS];
+};
 
 static void check_page_free_list();
 static void check_page_alloc(void);
@@ -24,80 +57,290 @@ static void check_kern_pgdir(void);
 static physaddr_t check_va2pa(pde_t *pgdir, uintptr_t va);
 static void check_page(void);
 static void check_page_installed_pgdir(void);
+static void check_map_region(void);
+static void check_asid(void);
+static void check_page_remove_range(void);
+static int check_count_free(void);
+static void check_steal_free(struct FreeStash *stash);
+static void check_return_free(struct FreeStash *stash);
+
+// The hardware table walker does not look in the L1 data cache, so
+// every page-table update has to be cleaned out to memory.
+static inline void pgtbl_sync(void *entry, size_t len)
+{
+    dcache_clean_range(entry, len);
+}
 
 static void set_domain(int did, int priv) {
-    int clear_bit = ~(11 << (2 * did));
-    int new_priv = priv << (2 * did);
-    asm("mrc p15, 0, r0, c3, c0, 0\n"
-	    "and r0, r0, %0\n"
-	    "orr r0, r0, %1\n"
-	    "mcr p15, 0, r0, c3, c0, 0\n" 
-	    : 
-	    : "r"(clear_bit), "r"(new_priv)
-	    : "r0");
+    uint32_t dacr = read_dacr();
+
+    dacr &= ~(3 << (2 * did));
+    dacr |= priv << (2 * did);
+    write_dacr(dacr);
 }
 
-void mem_init()
+// Size physical memory from the boot loader's ATAG list or device tree.
+static void arm_detect_memory(physaddr_t bootinfo)
 {
-    page_init();
+    physaddr_t mem = bootinfo_memsize(bootinfo);
 
+    if (mem == 0) {
+	cprintf("No memory size from the boot loader, assuming %uMB\n",
+		DEFAULT_PHYS_MEM / (1024 * 1024));
+	mem = DEFAULT_PHYS_MEM;
+    }
+    if (mem > PERIPH_PHYS)
+	mem = PERIPH_PHYS;
+    // The kernel can only address what fits above KERNBASE.
+    if (mem > (physaddr_t) -KERNBASE) {
+	cprintf("Only using %uMB of %uMB of physical memory\n",
+		(physaddr_t) -KERNBASE / (1024 * 1024), mem / (1024 * 1024));
+	mem = (physaddr_t) -KERNBASE;
+    }
+    npages = mem / PGSIZE;
+    cprintf("Physical memory: %uK available\n", npages * PGSIZE / 1024);
+}
 
-    // map physical memory
-    for (uintptr_t addr = KERNBASE; addr != 0; addr += PTSIZE) {
-	kern_pgdir[PDX(addr)] = PADDR((void*)addr) | PDE_ENTRY_1M | PDE_NONE_U;
-	kern_pgdir[PDX(PADDR((void*)addr))] = 0;
+// This simple physical memory allocator is used only while JOS is setting
+// up its virtual memory system.  It hands out pages right after the end
+// of the kernel image, so they must stay within what entry_pgdir maps.
+// The memory is not zeroed.
+static void *boot_alloc(uint32_t n)
+{
+    static char *nextfree;	// virtual address of next byte of free memory
+    char *result;
+
+    if (!nextfree) {
+	extern char end[];
+	nextfree = ROUNDUP((char *) end, PGSIZE);
     }
+    result = nextfree;
+    nextfree = ROUNDUP(nextfree + n, PGSIZE);
+    if (PADDR(nextfree) > EARLYMEM || PADDR(nextfree) > npages * PGSIZE)
+	panic("boot_alloc: out of memory");
+    return result;
+}
+
+void mem_init(physaddr_t bootinfo)
+{
+    uint64_t t0;
+
+    arm_detect_memory(bootinfo);
+    boot_trace("detect_memory");
+
+    // The PageInfo array is never cleared: page_init() and the buddy
+    // allocator only read the PageInfo of a page once they set it up.
+    pages = boot_alloc(npages * sizeof(struct PageInfo));
+
+    t0 = time_ns();
+    page_init();
+    cprintf("page_init: %d free pages in %d extents, %u us\n",
+	    check_count_free(), npage_extents,
+	    (uint32_t) ((time_ns() - t0) / NSEC_PER_USEC));
+    boot_trace("page_init");
+
+    // map physical memory, mostly with supersections
+    map_region(kern_pgdir, KERNBASE, npages * PGSIZE, 0, PTE_NONE_U | PTE_CACHED);
 
     // map kernel stack
-    kern_pgdir[PDX(KSTACKTOP - KSTKSIZE)] = PADDR(bootstack) | PDE_ENTRY_1M | PDE_NONE_U;
+    map_region(kern_pgdir, KSTACKTOP - KSTKSIZE, KSTKSIZE, PADDR(bootstack),
+	       PTE_NONE_U | PTE_CACHED);
 
     // map gpio memory-map
-    kern_pgdir[PDX(GPIOBASE)] = 0x3F200000 | PDE_ENTRY_1M | PDE_NONE_U;
+    map_region(kern_pgdir, GPIOBASE, PTSIZE, 0x3F200000, PTE_NONE_U);
+
+    // map the rest of the peripherals (system timer, interrupt controller)
+    map_region(kern_pgdir, MMIOBASE, PTSIZE, 0x3F000000, PTE_NONE_U);
 
+    pgtbl_sync(kern_pgdir, sizeof(kern_pgdir));
 
+    // nG, APX and XN need the ARMv6 extended page table format; ARMv7
+    // always uses it.  kern_pgdir translates the kernel half through
+    // TTBR1 and stands in for the user half until an address space is
+    // switched to.
+    write_sctlr(read_sctlr() | SCTLR_XP);
+    load_kern_pgdir(PADDR(kern_pgdir));
     load_pgdir(PADDR(kern_pgdir));
+    write_contextidr(KERN_ASID);
+    write_ttbcr(TTBCR_N(1));
+    isb();
+    tlb_invalidate_all();
     set_domain(0, DOMAIN_CLIENT);
+    boot_trace("map kern_pgdir");
 
     check_page_free_list();
+    boot_trace("check_page_free_list");
     check_page_alloc();
+    boot_trace("check_page_alloc");
     check_page();
+    boot_trace("check_page");
     check_kern_pgdir();
+    boot_trace("check_kern_pgdir");
     check_page_installed_pgdir();
+    boot_trace("check_page_installed_pgdir");
+    check_map_region();
+    boot_trace("check_map_region");
+    check_asid();
+    boot_trace("check_asid");
+    check_page_remove_range();
+    boot_trace("check_page_remove_range");
+}
+
+static void page_extent_add(physaddr_t start, physaddr_t end)
+{
+    struct PageExtent *e;
+
+    start = ROUNDUP(start, PGSIZE);
+    end = ROUNDDOWN(end, PGSIZE);
+    if (start >= end)
+	return;
+    assert(npage_extents < NEXTENTS);
+    e = &page_extents[npage_extents++];
+    e->pe_start = e->pe_carved = PGNUM(start);
+    e->pe_end = PGNUM(end);
 }
 
 void page_init(void)
 {
-    extern char end[];
-    for (physaddr_t addr = 0; addr < TOTAL_PHYS_MEM; addr += PGSIZE) {
-	struct PageInfo *pg = pa2page(addr);
-	if (addr == 0 || (0x100000 <= addr && addr < PADDR(end)))
+    // Page 0, the kernel image and whatever boot_alloc() handed out
+    // (pages[]) are in use.
+    page_extent_add(PGSIZE, 0x100000);
+    page_extent_add(PADDR(boot_alloc(0)), npages * PGSIZE);
+}
+
+// Whether page 'idx' has been handed to the buddy allocator, so that
+// its PageInfo can be trusted.
+static bool page_carved(size_t idx)
+{
+    for (int i = 0; i < npage_extents; i++)
+	if (page_extents[i].pe_start <= idx && idx < page_extents[i].pe_carved)
+	    return true;
+    return false;
+}
+
+// The head of a block split off a larger one is an interior page whose
+// PageInfo has never been set up, so every field is assigned here.
+static void free_list_push(struct PageInfo *pp, int order)
+{
+    pp->pp_order = order;
+    pp->pp_ref = 0;
+    pp->pp_flags = PP_FREE;
+    pp->pp_prev = NULL;
+    pp->pp_link = page_free_lists[order];
+    if (pp->pp_link)
+	pp->pp_link->pp_prev = pp;
+    page_free_lists[order] = pp;
+}
+
+static void free_list_remove(struct PageInfo *pp, int order)
+{
+    if (pp->pp_prev)
+	pp->pp_prev->pp_link = pp->pp_link;
+    else
+	page_free_lists[order] = pp->pp_link;
+    if (pp->pp_link)
+	pp->pp_link->pp_prev = pp->pp_prev;
+    pp->pp_flags &= ~PP_FREE;
+}
+
+// Hand the largest naturally aligned block at the front of an extent to
+// the buddy allocator.  Returns false once every extent is used up.
+static bool page_extent_carve(void)
+{
+    struct PageExtent *e;
+    struct PageInfo *pp;
+    int order;
+
+    for (e = page_extents; e < page_extents + npage_extents; e++) {
+	if (e->pe_carved == e->pe_end)
 	    continue;
-	pg->pp_ref = 0;
-	pg->pp_link = page_free_list;
-	page_free_list = pg;
+	order = 0;
+	while (order < PAGE_MAX_ORDER
+	       && e->pe_carved % (2 << order) == 0
+	       && e->pe_carved + (2 << order) <= e->pe_end)
+	    order++;
+	pp = &pages[e->pe_carved];
+	pp->pp_ref = 0;
+	pp->pp_flags = 0;
+	e->pe_carved += 1 << order;
+	page_free_order(pp, order);
+	return true;
     }
+    return false;
 }
 
-struct PageInfo * page_alloc(int alloc_flags)
+// Allocate 2^order physically contiguous pages, aligned to their size.
+// Takes the smallest free block that is large enough and splits it,
+// handing the upper halves back to the lower-order lists.
+struct PageInfo * page_alloc_order(int order, int alloc_flags)
 {
-    if (page_free_list == NULL) return NULL;
-    struct PageInfo* ret = page_free_list;
-    page_free_list = ret->pp_link;
-    if (alloc_flags & ALLOC_ZERO) 
-	memset(page2kva(ret), 0, PGSIZE);
-    ret->pp_link = NULL;
-    return ret;
+    struct PageInfo *pp;
+    int o;
+
+    assert(order >= 0 && order <= PAGE_MAX_ORDER);
+    while (1) {
+	for (o = order; o <= PAGE_MAX_ORDER && !page_free_lists[o]; o++)
+	    /* do nothing */;
+	if (o <= PAGE_MAX_ORDER)
+	    break;
+	if (!page_extent_carve())
+	    return NULL;
+    }
+
+    pp = page_free_lists[o];
+    free_list_remove(pp, o);
+    while (o > order) {
+	o--;
+	free_list_push(pp + (1 << o), o);
+    }
+
+    // Pages carved from an extent have never had their PageInfo set up.
+    for (int i = 0; i < (1 << order); i++) {
+	pp[i].pp_link = NULL;
+	pp[i].pp_ref = 0;
+	pp[i].pp_flags = 0;
+    }
+    if (alloc_flags & ALLOC_ZERO)
+	for (int i = 0; i < (1 << order); i++)
+	    page_zero(page2kva(pp + i));
+    return pp;
 }
 
-void page_free(struct PageInfo *pp)
+// Return a block from page_alloc_order().  It merges with its buddy
+// for as long as the buddy is a free block of the same order.
+void page_free_order(struct PageInfo *pp, int order)
 {
-    if (pp->pp_ref == 0) {
-	pp->pp_link = page_free_list;
-	page_free_list = pp;
-    }
-    else {
+    size_t idx = pp - pages, bidx;
+    struct PageInfo *buddy;
+
+    if (pp->pp_ref != 0)
 	panic("pp->pp_ref is not zero. Wrong call of the page_free!!!");
+    assert(!(pp->pp_flags & PP_FREE));
+    assert(idx % (1 << order) == 0);
+
+    for (; order < PAGE_MAX_ORDER; order++) {
+	bidx = idx ^ (1 << order);
+	if (!page_carved(bidx))
+	    break;
+	buddy = &pages[bidx];
+	if (!(buddy->pp_flags & PP_FREE) || buddy->pp_order != order)
+	    break;
+	free_list_remove(buddy, order);
+	idx &= ~(1 << order);
     }
+    free_list_push(&pages[idx], order);
+}
+
+// The single-page allocator is the order-0 case: when an order-0 block
+// is free it is popped straight off its list.
+struct PageInfo * page_alloc(int alloc_flags)
+{
+    return page_alloc_order(0, alloc_flags);
+}
+
+void page_free(struct PageInfo *pp)
+{
+    page_free_order(pp, 0);
 }
 
 void page_decref(struct PageInfo* pp)
@@ -106,62 +349,513 @@ void page_decref(struct PageInfo* pp)
 	page_free(pp);
 }
 
-static pte_t* pgtbl_alloc()
+// An L2 page table is 1KB, so four of them share a physical page.  The
+// page's PageInfo has PP_PGTBL set, counts the tables in use in pp_ref
+// and the valid entries of each table in pp_ptecnt.  Free tables are
+// threaded onto pgtbl_free_list through their own memory; once all
+// four tables of a page are free the page goes back to page_free().
+#define PGTBL_SIZE	(NPTENTRIES * sizeof(pte_t))
+#define PGTBL_PER_PAGE	(PGSIZE / PGTBL_SIZE)
+#define PGTBL_SLOT(pa)	(((physaddr_t) (pa) % PGSIZE) / PGTBL_SIZE)
+
+struct PgtblFree {
+    struct PgtblFree *pf_next;
+    struct PgtblFree *pf_prev;
+};
+
+static struct PgtblFree *pgtbl_free_list;
+
+static void pgtbl_free_push(void *tbl)
+{
+    struct PgtblFree *f = tbl;
+
+    f->pf_prev = NULL;
+    f->pf_next = pgtbl_free_list;
+    if (f->pf_next)
+	f->pf_next->pf_prev = f;
+    pgtbl_free_list = f;
+}
+
+static void pgtbl_free_remove(void *tbl)
+{
+    struct PgtblFree *f = tbl;
+
+    if (f->pf_prev)
+	f->pf_prev->pf_next = f->pf_next;
+    else
+	pgtbl_free_list = f->pf_next;
+    if (f->pf_next)
+	f->pf_next->pf_prev = f->pf_prev;
+}
+
+// Allocate a zeroed L2 page table, splitting a fresh page into four if
+// no table is free.
+static pte_t *pgtbl_alloc(void)
+{
+    struct PageInfo *pp;
+    struct PgtblFree *f;
+
+    if (!pgtbl_free_list) {
+	if (!(pp = page_alloc(0)))
+	    return NULL;
+	pp->pp_flags |= PP_PGTBL;
+	// Pushed from the top, so the tables are handed out in order.
+	for (int i = PGTBL_PER_PAGE - 1; i >= 0; i--) {
+	    pp->pp_ptecnt[i] = 0;
+	    pgtbl_free_push((char *) page2kva(pp) + i * PGTBL_SIZE);
+	}
+    }
+
+    f = pgtbl_free_list;
+    pgtbl_free_remove(f);
+    pa2page(PADDR(f))->pp_ref++;
+    memset(f, 0, PGTBL_SIZE);
+    pgtbl_sync(f, PGTBL_SIZE);
+    return (pte_t *) f;
+}
+
+static void pgtbl_free(pte_t *tbl)
+{
+    struct PageInfo *pp = pa2page(PADDR(tbl));
+    char *base = page2kva(pp);
+
+    assert(pp->pp_flags & PP_PGTBL);
+    assert(pp->pp_ptecnt[PGTBL_SLOT(PADDR(tbl))] == 0);
+    pgtbl_free_push(tbl);
+    if (--pp->pp_ref > 0)
+	return;
+
+    for (int i = 0; i < PGTBL_PER_PAGE; i++)
+	pgtbl_free_remove(base + i * PGTBL_SIZE);
+    pp->pp_flags &= ~PP_PGTBL;
+    page_free(pp);
+}
+
+// Write an L2 entry, keeping its table's count of valid entries.
+static void pte_set(pte_t *pte, pte_t val)
+{
+    physaddr_t pa = PADDR(pte);
+    struct PageInfo *pp = pa2page(pa);
+
+    if ((*pte & PTE_P) && !(val & PTE_P))
+	pp->pp_ptecnt[PGTBL_SLOT(pa)]--;
+    else if (!(*pte & PTE_P) && (val & PTE_P))
+	pp->pp_ptecnt[PGTBL_SLOT(pa)]++;
+    *pte = val;
+    pgtbl_sync(pte, sizeof(pte_t));
+}
+
+// Free the L2 table covering 'va', and clear its PDE, if the table no
+// longer maps anything.  The caller invalidates 'va' in the TLB.
+// Returns whether the table was freed.
+static bool pgtbl_release(pde_t *pgdir, const void *va)
+{
+    pde_t *pde = &pgdir[PDX(va)];
+    physaddr_t pa = PDE_ADDR(*pde);
+
+    if ((*pde & PDE_P) != PDE_ENTRY)
+	return false;
+    if (pa2page(pa)->pp_ptecnt[PGTBL_SLOT(pa)] != 0)
+	return false;
+    *pde = 0;
+    pgtbl_sync(pde, sizeof(pde_t));
+    pgtbl_free(KADDR(pa));
+    return true;
+}
+
+// Mapping attributes are passed around in small page layout (the PTE_*
+// bits page_insert() takes) and moved to where the other descriptor
+// formats keep them.
+static pde_t attr_to_section(pte_t attr)
+{
+    return (attr & PTE_CACHED)
+	| ((attr >> 4) & 3) << 10		// AP
+	| ((attr >> 6) & 7) << 12		// TEX
+	| (attr & PTE_APX ? PDE_APX : 0)
+	| (attr & PTE_S ? PDE_S : 0)
+	| (attr & PTE_NG ? PDE_NG : 0)
+	| (attr & PTE_XN ? PDE_XN : 0);
+}
+
+static pte_t section_to_attr(pde_t pde)
+{
+    return (pde & PDE_CACHED)
+	| ((pde >> 10) & 3) << 4
+	| ((pde >> 12) & 7) << 6
+	| (pde & PDE_APX ? PTE_APX : 0)
+	| (pde & PDE_S ? PTE_S : 0)
+	| (pde & PDE_NG ? PTE_NG : 0)
+	| (pde & PDE_XN ? PTE_XN : 0);
+}
+
+static pte_t attr_to_large(pte_t attr)
+{
+    return (attr & (PTE_CACHED | PTE_RW_U | PTE_APX | PTE_S | PTE_NG))
+	| ((attr >> 6) & 7) << 12
+	| (attr & PTE_XN ? PTE_LARGE_XN : 0);
+}
+
+static pte_t large_to_attr(pte_t pte)
 {
-    static pte_t* tbl = NULL;
-    if ((uintptr_t)tbl % PGSIZE == 0) {
-	struct PageInfo *pg = page_alloc(ALLOC_ZERO);
-	if (pg == NULL) return NULL;
-	tbl = page2kva(pg);
-	pg->pp_ref++;
+    return (pte & (PTE_CACHED | PTE_RW_U | PTE_APX | PTE_S | PTE_NG))
+	| ((pte >> 12) & 7) << 6
+	| (pte & PTE_LARGE_XN ? PTE_XN : 0);
+}
+
+static inline bool pde_is_section(pde_t pde)
+{
+    return (pde & PDE_P) == PDE_ENTRY_1M;
+}
+
+static inline bool pte_is_large(pte_t pte)
+{
+    return (pte & PTE_P) == PTE_ENTRY_LARGE;
+}
+
+// Turn the supersection that 'pde' is part of back into the 16 sections
+// it covers.
+static void pde_split_super(pde_t *pde)
+{
+    pde_t *group = ROUNDDOWN(pde, 16 * sizeof(pde_t));
+    physaddr_t base = group[0] & 0xFF000000;
+    pde_t attr = group[0] & (PDE_SUPER - 1);
+
+    for (int i = 0; i < 16; i++)
+	group[i] = (base + i * PTSIZE) | attr;
+    pgtbl_sync(group, 16 * sizeof(pde_t));
+    tlb_invalidate_all();
+}
+
+// Replace the section at 'pde' with an L2 table that maps the same
+// megabyte with 64KB large pages, so that part of it can be remapped.
+static int pde_split_section(pde_t *pde)
+{
+    physaddr_t base;
+    pte_t attr;
+    pte_t *tbl;
+
+    if (*pde & PDE_SUPER)
+	pde_split_super(pde);
+    base = *pde & 0xFFF00000;
+    attr = attr_to_large(section_to_attr(*pde));
+    if (!(tbl = pgtbl_alloc()))
+	return -E_NO_MEM;
+    for (int i = 0; i < NPTENTRIES; i++)
+	tbl[i] = (base + ROUNDDOWN(i * PGSIZE, LPGSIZE)) | attr | PTE_ENTRY_LARGE;
+    pa2page(PADDR(tbl))->pp_ptecnt[PGTBL_SLOT(PADDR(tbl))] = NPTENTRIES;
+    pgtbl_sync(tbl, PGTBL_SIZE);
+
+    *pde = PADDR(tbl) | PDE_ENTRY;
+    pgtbl_sync(pde, sizeof(pde_t));
+    tlb_invalidate_all();
+    return 0;
+}
+
+// Turn the large page that 'pte' is part of into 16 small pages.
+static void pte_split_large(pte_t *pte)
+{
+    pte_t *group = ROUNDDOWN(pte, 16 * sizeof(pte_t));
+    physaddr_t base = PTE_LARGE_ADDR(group[0]);
+    pte_t attr = large_to_attr(group[0]);
+
+    if (!pte_is_large(*pte))
+	return;
+    for (int i = 0; i < 16; i++)
+	group[i] = (base + i * PGSIZE) | attr | PTE_ENTRY_SMALL;
+    pgtbl_sync(group, 16 * sizeof(pte_t));
+    tlb_invalidate_all();
+}
+
+// Clear the L1 entry at 'pde', freeing the L2 table it points to.  The
+// pages the table mapped keep their reference counts.  Returns whether
+// anything was mapped.
+static bool pde_clear(pde_t *pde)
+{
+    physaddr_t pa = PDE_ADDR(*pde);
+
+    if (!(*pde & PDE_P))
+	return false;
+    if (pde_is_section(*pde) && (*pde & PDE_SUPER))
+	pde_split_super(pde);
+    if ((*pde & PDE_P) == PDE_ENTRY) {
+	*pde = 0;
+	pgtbl_sync(pde, sizeof(pde_t));
+	pa2page(pa)->pp_ptecnt[PGTBL_SLOT(pa)] = 0;
+	pgtbl_free(KADDR(pa));
+    } else {
+	*pde = 0;
+	pgtbl_sync(pde, sizeof(pde_t));
     }
-    pte_t *ret = tbl;
-    tbl += NPTENTRIES * 4;
-    return ret;
+    return true;
 }
 
+// Return the L2 entry for 'va', creating the table if 'create' is set.
+// A section or supersection covering 'va' has no L2 entry; it is split
+// into large pages only when 'create' is set.
 pte_t * pgdir_walk(pde_t *pgdir, const void *va, int create)
 {
-    if (!(pgdir[PDX(va)] & PTE_P)) {
+    pde_t *pde = &pgdir[PDX(va)];
+
+    assert(pgdir == kern_pgdir || (uintptr_t) va < USERTOP);
+
+    if (pde_is_section(*pde)) {
+	if (!create) return NULL;
+	if (pde_split_section(pde) < 0) return NULL;
+    } else if (!(*pde & PDE_P)) {
 	if (!create) return NULL;
 	pte_t* pgtbl = pgtbl_alloc();
 	if (!pgtbl) return NULL;
-	pgdir[PDX(va)] = PADDR(pgtbl) | PDE_ENTRY;
+	*pde = PADDR(pgtbl) | PDE_ENTRY;
+	pgtbl_sync(pde, sizeof(pde_t));
     }
-    pte_t *pgtbl = (pte_t*)KADDR(PDE_ADDR(pgdir[PDX(va)]));
+    pte_t *pgtbl = (pte_t*)KADDR(PDE_ADDR(*pde));
     return &pgtbl[PTX(va)];
 }
 
-static void boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa)
+// Map [va, va+size) to physical [pa, pa+size) with attributes 'attr'
+// (PTE_* bits in small page layout).  Each chunk gets the largest
+// descriptor its alignment and length allow: a 16MB supersection, a 1MB
+// section, a 64KB large page or a 4KB small page.  Whatever was mapped
+// there before is replaced, splitting larger mappings that are only
+// partly covered; the reference counts of replaced pages are not
+// touched.  Panics if it runs out of memory for page tables.
+//
+// None of these mappings holds a reference on its frame, and a small
+// page here looks just like one of page_insert()'s, so map_region() is
+// for kern_pgdir only: user page directories hold nothing but counted
+// small pages.
+void map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int attr)
 {
-    assert(va % PGSIZE == 0);
-    assert(pa % PGSIZE == 0);
-    for (int i = 0; i < size; i += PGSIZE) {
-	pte_t *pte = pgdir_walk(pgdir, (void*)(va + i), 1);
-	if (pte) {
-	    *pte = (pa + i) | PTE_ENTRY_SMALL | PTE_NONE_U;
+    bool flush = false;
+    size_t n;
+    pde_t *pde;
+    pte_t *pte;
+
+    assert(pgdir == kern_pgdir);
+    assert(va % PGSIZE == 0 && pa % PGSIZE == 0 && size % PGSIZE == 0);
+    attr &= ~PTE_ENTRY_SMALL;
+
+    for (; size > 0; va += n, pa += n, size -= n) {
+	pde = &pgdir[PDX(va)];
+	if ((va | pa) % SUPSIZE == 0 && size >= SUPSIZE) {
+	    n = SUPSIZE;
+	    for (int i = 0; i < 16; i++)
+		flush |= pde_clear(&pde[i]);
+	    for (int i = 0; i < 16; i++)
+		pde[i] = pa | PDE_ENTRY_16M | attr_to_section(attr);
+	    pgtbl_sync(pde, 16 * sizeof(pde_t));
+	} else if ((va | pa) % PTSIZE == 0 && size >= PTSIZE) {
+	    n = PTSIZE;
+	    flush |= pde_clear(pde);
+	    *pde = pa | PDE_ENTRY_1M | attr_to_section(attr);
+	    pgtbl_sync(pde, sizeof(pde_t));
+	} else if (!(pte = pgdir_walk(pgdir, (void *) va, 1))) {
+	    panic("map_region: out of memory");
+	} else if ((va | pa) % LPGSIZE == 0 && size >= LPGSIZE) {
+	    n = LPGSIZE;
+	    for (int i = 0; i < 16; i++) {
+		flush |= !!(pte[i] & PTE_P);
+		pte_set(&pte[i], pa | attr_to_large(attr) | PTE_ENTRY_LARGE);
+	    }
+	} else {
+	    n = PGSIZE;
+	    pte_split_large(pte);
+	    flush |= !!(*pte & PTE_P);
+	    pte_set(pte, pa | attr | PTE_ENTRY_SMALL);
 	}
-	else {
-	    panic("boot_map_region out of memory\n");
+    }
+    if (flush)
+	tlb_invalidate_all();
+}
+
+// ASIDs.  Non-global TLB entries are tagged with the ASID in CONTEXTIDR,
+// so switching between user address spaces needs no TLB flush.  Each
+// user page directory remembers the ASID it was given along with the
+// generation it was given in.  When a generation's 255 ASIDs are used
+// up, the whole TLB is flushed and a new generation starts; every space
+// then picks up a fresh ASID the next time it is switched to.
+#define ASID_BITS	8
+#define ASID_MASK	((1 << ASID_BITS) - 1)
+
+static uint32_t asid_generation = 1 << ASID_BITS;
+static uint32_t asid_next = KERN_ASID + 1;
+static pde_t *cur_pgdir = kern_pgdir;
+
+static uint32_t asid_alloc(void)
+{
+    if (asid_next > ASID_MASK) {
+	asid_generation += 1 << ASID_BITS;
+	if (asid_generation == 0)
+	    asid_generation = 1 << ASID_BITS;
+	asid_next = KERN_ASID + 1;
+	tlb_invalidate_all();
+    }
+    return asid_generation | asid_next++;
+}
+
+// The ASID that 'pgdir's TLB entries carry, or -1 if it cannot have
+// any because it has not run since the last rollover.
+int pgdir_asid(pde_t *pgdir)
+{
+    struct PageInfo *pp;
+
+    if (pgdir == kern_pgdir)
+	return KERN_ASID;
+    pp = pa2page(PADDR(pgdir));
+    assert(pp->pp_flags & PP_PGDIR);
+    if ((pp->pp_asid & ~ASID_MASK) != asid_generation)
+	return -1;
+    return pp->pp_asid & ASID_MASK;
+}
+
+// Allocate an empty user page directory: the NUPDENTRIES entries that
+// TTBR0 translates, 8KB and aligned to its size.
+pde_t *pgdir_create(void)
+{
+    struct PageInfo *pp;
+
+    if (!(pp = page_alloc_order(1, ALLOC_ZERO)))
+	return NULL;
+    pp->pp_flags |= PP_PGDIR;
+    pp->pp_asid = 0;
+    pgtbl_sync(page2kva(pp), NUPDENTRIES * sizeof(pde_t));
+    return page2kva(pp);
+}
+
+// Free a user page directory that is not running.  Drops the
+// references its page mappings hold and frees its page tables.
+void pgdir_destroy(pde_t *pgdir)
+{
+    struct PageInfo *pp = pa2page(PADDR(pgdir));
+    pte_t *tbl;
+
+    assert(pp->pp_flags & PP_PGDIR);
+    assert(pgdir != cur_pgdir);
+    for (int i = 0; i < NUPDENTRIES; i++) {
+	if ((pgdir[i] & PDE_P) == PDE_ENTRY) {
+	    tbl = KADDR(PDE_ADDR(pgdir[i]));
+	    for (int j = 0; j < NPTENTRIES; j++)
+		if (tbl[j] & PTE_P) {
+		    assert(!pte_is_large(tbl[j]));
+		    page_decref(pa2page(PTE_SMALL_ADDR(tbl[j])));
+		}
 	}
+	assert(!pde_is_section(pgdir[i]));
+	pde_clear(&pgdir[i]);
     }
+    tlb_invalidate_asid(pgdir_asid(pgdir));
+    pp->pp_flags &= ~PP_PGDIR;
+    page_free_order(pp, 1);
 }
 
-int page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
+// Copy the user page directory 'src'.  No page is copied: both
+// directories map the same pages, and writable ones become
+// copy-on-write in each, so the cost is one pass over the page tables.
+// A user page directory holds no sections or large pages (see
+// map_region()), which could be neither counted nor made copy-on-write.
+// Returns NULL if out of memory.
+pde_t *pgdir_dup(pde_t *src)
 {
-    pte_t *pte = pgdir_walk(pgdir, va, 1);
-    if (pte == NULL) return -E_NO_MEM;
-    if (*pte & PTE_P) {
-	if (PTE_SMALL_ADDR(*pte) == page2pa(pp)) {
-	    pp->pp_ref--;
-	    tlb_invalidate(pgdir, va);
+    struct TlbGather tg;
+    pde_t *dst;
+    pte_t *stbl, *dtbl, pte;
+    int i, j, n;
+
+    assert(src != kern_pgdir);
+    if (!(dst = pgdir_create()))
+	return NULL;
+    tlb_gather_init(&tg, src);
+    for (i = 0; i < NUPDENTRIES; i++) {
+	if (!(src[i] & PDE_P))
+	    continue;
+	assert(!pde_is_section(src[i]));
+	if (!(dtbl = pgtbl_alloc())) {
+	    tlb_gather_flush(&tg);
+	    pgdir_destroy(dst);
+	    return NULL;
 	}
-	else {
-	    page_remove(pgdir, va);
+	stbl = KADDR(PDE_ADDR(src[i]));
+	n = 0;
+	for (j = 0; j < NPTENTRIES; j++) {
+	    if (!((pte = stbl[j]) & PTE_P))
+		continue;
+	    assert(!pte_is_large(pte));
+	    pa2page(PTE_SMALL_ADDR(pte))->pp_ref++;
+	    if ((pte & (PTE_APX | PTE_RW_U)) == PTE_RW_U) {
+		pte |= PTE_APX;
+		stbl[j] = pte;
+		tlb_gather_add(&tg, PGADDR(i, j, 0));
+	    }
+	    dtbl[j] = pte;
+	    n++;
 	}
+	pa2page(PADDR(dtbl))->pp_ptecnt[PGTBL_SLOT(PADDR(dtbl))] = n;
+	pgtbl_sync(stbl, PGTBL_SIZE);
+	pgtbl_sync(dtbl, PGTBL_SIZE);
+	// Keep the type and domain bits below the table address.
+	dst[i] = PADDR(dtbl) | (src[i] & 0x3FF);
+	pgtbl_sync(&dst[i], sizeof(pde_t));
     }
-    *pte = page2pa(pp) | perm | PTE_P;
+    tlb_gather_flush(&tg);
+    return dst;
+}
+
+// Run with 'pgdir' as the user half of the address space (kern_pgdir
+// for none).  Only TTBR0 and CONTEXTIDR change; the TLB is kept.
+void pgdir_switch(pde_t *pgdir)
+{
+    int asid = KERN_ASID;
+    struct PageInfo *pp;
+
+    // The hardware must never pair an ASID with another space's
+    // table, so TTBR0 waits on kern_pgdir, whose entries are all
+    // global, while the ASID changes.
+    load_pgdir(PADDR(kern_pgdir));
+    isb();
+    if (pgdir != kern_pgdir) {
+	pp = pa2page(PADDR(pgdir));
+	assert(pp->pp_flags & PP_PGDIR);
+	if ((pp->pp_asid & ~ASID_MASK) != asid_generation)
+	    pp->pp_asid = asid_alloc();
+	asid = pp->pp_asid & ASID_MASK;
+    }
+    write_contextidr(asid);
+    // The ARM1176 branch target cache is indexed by virtual address only.
+    bp_invalidate_all();
+    isb();
+    load_pgdir(PADDR(pgdir));
+    isb();
+    cur_pgdir = pgdir;
+}
+
+// Only the small pages page_insert() maps hold a reference on their
+// frame.  What map_region() maps, in kern_pgdir alone, holds none, so
+// page_insert() refuses to replace a large page or section with
+// -E_INVAL, page_lookup() returns NULL for one, and page_remove()
+// leaves it mapped.
+int page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
+{
+    pte_t *pte;
+    pte_t old;
+
+    if (pde_is_section(pgdir[PDX(va)])) return -E_INVAL;
+    pte = pgdir_walk(pgdir, va, 1);
+    if (pte == NULL) return -E_NO_MEM;
+    if (pte_is_large(*pte)) return -E_INVAL;
+    // Take the new reference first, so that re-inserting the page
+    // already mapped at 'va' does not free it.  The old mapping is
+    // replaced in place rather than through page_remove(), which could
+    // free the table 'pte' points into.
+    // Mappings in a user page directory are tagged with its ASID.
+    if (pgdir != kern_pgdir)
+	perm |= PTE_NG;
     pp->pp_ref++;
+    old = *pte;
+    pte_set(pte, page2pa(pp) | perm | PTE_CACHED | PTE_P);
+    if (old & PTE_P) {
+	tlb_invalidate(pgdir_asid(pgdir), va);
+	page_decref(pa2page(PTE_SMALL_ADDR(old)));
+    }
     return 0;
 }
 
@@ -169,27 +863,142 @@ struct PageInfo * page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
 {
     pte_t *pte = pgdir_walk(pgdir, va, 0);
     if (pte_store != NULL) *pte_store = pte;
-    if (pte == NULL || !(*pte & PTE_P)) return NULL;
+    if (pte == NULL || !(*pte & PTE_P) || pte_is_large(*pte)) return NULL;
     return pa2page(PTE_SMALL_ADDR(*pte));
 }
 
+// Unmap 'va', and free its L2 table if that was the table's last entry.
 void page_remove(pde_t *pgdir, void *va)
 {
-    struct PageInfo *page = page_lookup(pgdir, va, 0);
-    pte_t *pte = pgdir_walk(pgdir, va, 0);
-    if (page != NULL) page_decref(page);
-    if (pte != NULL) {
-	*pte = 0;
-	tlb_invalidate(pgdir, va);
+    pte_t *pte;
+    struct PageInfo *page = page_lookup(pgdir, va, &pte);
+
+    if (pte == NULL) return;
+    if (page != NULL) {
+	pte_set(pte, 0);
+	page_decref(page);
     }
+    // One invalidate covers both the page and any cached walk of a
+    // table pgtbl_release() frees.
+    pgtbl_release(pgdir, va);
+    tlb_invalidate(pgdir_asid(pgdir), va);
 }
 
-void tlb_invalidate(pde_t *pgdir, void *va)
+// Unmap every page in [va, va+len), freeing L2 tables left empty.  Each
+// table is walked once, cleaned to memory once, and the TLB is flushed
+// in a single batch at the end.  Like page_remove(), this leaves
+// sections and large pages alone.  Pages are freed before the flush; that is
+// safe because nothing can allocate and reuse them before it happens.
+void page_remove_range(pde_t *pgdir, void *va, size_t len)
 {
-    asm("mcr p15, 0, %0, c8, c7, 1"
-	    :
-	    : "r"(va)
-	    :);
+    uintptr_t start = (uintptr_t) va, end = start + len, next;
+    struct TlbGather tg;
+    struct PageInfo *tpp;
+    pde_t *pde;
+    pte_t *tbl;
+    int i, first, last, slot;
+
+    assert(start % PGSIZE == 0 && len % PGSIZE == 0 && end >= start);
+    tlb_gather_init(&tg, pgdir);
+    for (; start < end; start = next) {
+	next = ROUNDDOWN(start, PTSIZE) + PTSIZE;
+	if (next == 0 || next > end)
+	    next = end;
+	pde = &pgdir[PDX(start)];
+	if ((*pde & PDE_P) != PDE_ENTRY)
+	    continue;
+
+	tbl = KADDR(PDE_ADDR(*pde));
+	tpp = pa2page(PDE_ADDR(*pde));
+	slot = PGTBL_SLOT(PDE_ADDR(*pde));
+	first = PTX(start);
+	last = PTX(next - 1);
+	for (i = first; i <= last; i++) {
+	    if (!(tbl[i] & PTE_P) || pte_is_large(tbl[i]))
+		continue;
+	    page_decref(pa2page(PTE_SMALL_ADDR(tbl[i])));
+	    tbl[i] = 0;
+	    tpp->pp_ptecnt[slot]--;
+	    tlb_gather_add(&tg, (void *) (ROUNDDOWN(start, PTSIZE) + i * PGSIZE));
+	}
+	pgtbl_sync(&tbl[first], (last - first + 1) * sizeof(pte_t));
+	// A freed table may still be in a cached walk.
+	if (pgtbl_release(pgdir, (void *) start))
+	    tlb_gather_add(&tg, (void *) start);
+    }
+    tlb_gather_flush(&tg);
+}
+
+// Drop the translation of 'va' in address space 'asid'.  Global
+// (kernel) entries match any ASID.  A negative 'asid' comes from
+// pgdir_asid() for a space with nothing in the TLB, and is a no-op.
+void tlb_invalidate(int asid, void *va)
+{
+    if (asid < 0)
+	return;
+    tlbimva(ROUNDDOWN((uintptr_t) va, PGSIZE) | asid);
+    dsb();
+    isb();
+}
+
+// Drop every non-global translation tagged with 'asid'.
+void tlb_invalidate_asid(int asid)
+{
+    if (asid < 0)
+	return;
+    tlbiasid(asid);
+    dsb();
+    isb();
+}
+
+void tlb_invalidate_all(void)
+{
+    tlbiall();
+    dsb();
+    isb();
+}
+
+// TLB gathers batch the invalidations for a run of page-table edits
+// into one flush with one set of barriers.  Past tlb_gather_threshold
+// pages, invalidating entry by entry costs more than refilling the TLB,
+// so the flush drops the whole ASID (or, for kern_pgdir, everything).
+int tlb_gather_threshold = 32;
+
+void tlb_gather_init(struct TlbGather *tg, pde_t *pgdir)
+{
+    tg->tg_asid = pgdir_asid(pgdir);
+    tg->tg_n = 0;
+    tg->tg_full = false;
+}
+
+void tlb_gather_add(struct TlbGather *tg, void *va)
+{
+    if (tg->tg_full || tg->tg_asid < 0)
+	return;
+    if (tg->tg_n >= MIN(tlb_gather_threshold, TLB_GATHER_MAX)) {
+	tg->tg_full = true;
+	return;
+    }
+    tg->tg_va[tg->tg_n++] = ROUNDDOWN((uintptr_t) va, PGSIZE);
+}
+
+void tlb_gather_flush(struct TlbGather *tg)
+{
+    if (tg->tg_asid < 0)
+	return;
+    if (tg->tg_full) {
+	if (tg->tg_asid == KERN_ASID)
+	    tlb_invalidate_all();
+	else
+	    tlb_invalidate_asid(tg->tg_asid);
+    } else if (tg->tg_n > 0) {
+	for (int i = 0; i < tg->tg_n; i++)
+	    tlbimva(tg->tg_va[i] | tg->tg_asid);
+	dsb();
+	isb();
+    }
+    tg->tg_n = 0;
+    tg->tg_full = false;
 }
 
 // --------------------------------------------------------------
@@ -197,19 +1006,65 @@ void tlb_invalidate(pde_t *pgdir, void *va)
 // --------------------------------------------------------------
 
 //
-// Check that the pages on the page_free_list are reasonable.
+// Check that the blocks on the free lists are reasonable.
 //
     static void
 check_page_free_list()
 {
-    int count = 0;
+    for (int order = 0; order <= PAGE_MAX_ORDER; order++)
+	for (struct PageInfo* pg = page_free_lists[order]; pg != NULL; pg = pg->pp_link) {
+	    assert(pg->pp_ref == 0);
+	    assert(pg->pp_flags & PP_FREE);
+	    assert(pg->pp_order == order);
+	    assert((pg - pages) % (1 << order) == 0);
+	    assert(pg->pp_link == NULL || pg->pp_link->pp_prev == pg);
+	}
+    assert(check_count_free() > 0);
+    cprintf("check_page_free_list() succeeded!\n");
+}
+
+// Number of free pages: every page of every free block, plus the
+// pages still waiting in the extents.
+static int check_count_free(void)
+{
+    int n = 0;
+
+    for (int order = 0; order <= PAGE_MAX_ORDER; order++)
+	for (struct PageInfo *pp = page_free_lists[order]; pp; pp = pp->pp_link)
+	    n += 1 << order;
+    for (int i = 0; i < npage_extents; i++)
+	n += page_extents[i].pe_end - page_extents[i].pe_carved;
+    return n;
+}
 
-    for (struct PageInfo* pg = page_free_list; pg != NULL; pg = pg->pp_link) {
-	assert(pg->pp_ref == 0);
-	count++;
+// Temporarily take every free block and extent away from the allocator,
+// so that the checks can run it dry.  The stolen blocks lose PP_FREE, so
+// pages freed in the meantime cannot merge with them.
+static void check_steal_free(struct FreeStash *stash)
+{
+    for (int order = 0; order <= PAGE_MAX_ORDER; order++) {
+	stash->fs_lists[order] = page_free_lists[order];
+	page_free_lists[order] = NULL;
+	for (struct PageInfo *pp = stash->fs_lists[order]; pp; pp = pp->pp_link)
+	    pp->pp_flags &= ~PP_FREE;
+    }
+    for (int i = 0; i < npage_extents; i++) {
+	stash->fs_end[i] = page_extents[i].pe_end;
+	page_extents[i].pe_end = page_extents[i].pe_carved;
     }
-    assert(count > 0);
-    cprintf("check_page_free_list() succeeded!\n");
+}
+
+static void check_return_free(struct FreeStash *stash)
+{
+    struct PageInfo *pp;
+
+    for (int i = 0; i < npage_extents; i++)
+	page_extents[i].pe_end = stash->fs_end[i];
+    for (int order = 0; order <= PAGE_MAX_ORDER; order++)
+	while ((pp = stash->fs_lists[order]) != NULL) {
+	    stash->fs_lists[order] = pp->pp_link;
+	    page_free_order(pp, order);
+	}
 }
 
 //
@@ -221,13 +1076,12 @@ check_page_alloc(void)
 {
     struct PageInfo *pp, *pp0, *pp1, *pp2;
     int nfree;
-    struct PageInfo *fl;
+    struct FreeStash fl;
     char *c;
     int i;
 
     // check number of free pages
-    for (pp = page_free_list, nfree = 0; pp; pp = pp->pp_link)
-	++nfree;
+    nfree = check_count_free();
 
     // should be able to allocate three pages
     pp0 = pp1 = pp2 = 0;
@@ -243,8 +1097,7 @@ check_page_alloc(void)
     assert(page2pa(pp2) < npages*PGSIZE);
 
     // temporarily steal the rest of the free pages
-    fl = page_free_list;
-    page_free_list = 0;
+    check_steal_free(&fl);
 
     // should be no free memory
     assert(!page_alloc(0));
@@ -272,7 +1125,7 @@ check_page_alloc(void)
 	assert(c[i] == 0);
 
     // give free list back
-    page_free_list = fl;
+    check_return_free(&fl);
 
     // free the pages we took
     page_free(pp0);
@@ -280,9 +1133,36 @@ check_page_alloc(void)
     page_free(pp2);
 
     // number of free pages should be the same
-    for (pp = page_free_list; pp; pp = pp->pp_link)
-	--nfree;
-    assert(nfree == 0);
+    assert(check_count_free() == nfree);
+
+    // multi-page blocks are contiguous, aligned and merge back on free
+    assert((pp0 = page_alloc_order(4, ALLOC_ZERO)));
+    assert(page2pa(pp0) % (PGSIZE << 4) == 0);
+    c = page2kva(pp0);
+    for (i = 0; i < (PGSIZE << 4); i++)
+	assert(c[i] == 0);
+    assert((pp1 = page_alloc_order(4, 0)));
+    assert(pp1 != pp0);
+    assert(pp1 + (1 << 4) <= pp0 || pp0 + (1 << 4) <= pp1);
+    assert(check_count_free() == nfree - 2 * (1 << 4));
+    page_free_order(pp0, 4);
+    page_free_order(pp1, 4);
+    assert(check_count_free() == nfree);
+
+    // with only two buddies left, freeing both gives back their parent
+    assert((pp0 = page_alloc_order(1, 0)));
+    check_steal_free(&fl);
+    page_free_order(pp0, 1);
+    assert((pp1 = page_alloc(0)) == pp0);
+    assert((pp2 = page_alloc(0)) == pp0 + 1);
+    assert(!page_alloc(0));
+    page_free(pp1);
+    page_free(pp2);
+    assert(page_free_lists[1] == pp0 && page_free_lists[0] == NULL);
+    assert((pp = page_alloc_order(1, 0)) == pp0);
+    page_free_order(pp, 1);
+    check_return_free(&fl);
+    assert(check_count_free() == nfree);
 
     cprintf("check_page_alloc() succeeded!\n");
 }
@@ -313,12 +1193,14 @@ static void check_kern_pgdir(void)
     for (i = 0; i < npages * PGSIZE; i += PGSIZE)
 	assert(check_va2pa(pgdir, KERNBASE + i) == i);
 
-    /*
     // check kernel stack
     for (i = 0; i < KSTKSIZE; i += PGSIZE)
-    assert(check_va2pa(pgdir, KSTACKTOP - KSTKSIZE + i) == PADDR(bootstack) + i);
+	assert(check_va2pa(pgdir, KSTACKTOP - KSTKSIZE + i) == PADDR(bootstack) + i);
     assert(check_va2pa(pgdir, KSTACKTOP - PTSIZE) == ~0);
-     */
+
+    // check peripherals
+    assert(check_va2pa(pgdir, GPIOBASE) == 0x3F200000);
+    assert(check_va2pa(pgdir, MMIOBASE + 0x3004) == 0x3F003004);
 
     // check PDE permissions
     for (i = 0; i < NPDENTRIES; i++) {
@@ -327,12 +1209,14 @@ static void check_kern_pgdir(void)
 	    case PDX(KSTACKTOP-1):
 		//	    case PDX(UPAGES):
 	    case PDX(GPIOBASE):
+	    case PDX(MMIOBASE):
 		assert(pgdir[i] & PTE_P);
 		break;
 	    default:
-		if (i >= PDX(KERNBASE)) {
+		if (i >= PDX(KERNBASE)
+		    && i < PDX(KERNBASE) + ROUNDUP(npages * PGSIZE, PTSIZE) / PTSIZE) {
 		    assert(pgdir[i] & PDE_P);
-		    assert(pgdir[i] & PDE_NONE_U);
+		    assert(!pde_is_section(pgdir[i]) || (pgdir[i] & PDE_NONE_U));
 		} else
 		    assert(pgdir[i] == 0);
 		break;
@@ -353,12 +1237,13 @@ static physaddr_t check_va2pa(pde_t *pgdir, uintptr_t va)
     if (!(*pgdir & PDE_P))
 	return ~0;
 
-    if ((*pgdir & PDE_ENTRY_1M) == PDE_ENTRY_1M) {
-	return (physaddr_t) (((*pgdir) & 0xFFF00000) + (va & 0xFFFFF));
-    } 
-    else if ((*pgdir & PDE_ENTRY_16M) == PDE_ENTRY_16M){
+    // A supersection also has the section type bits, so test it first.
+    if ((*pgdir & PDE_ENTRY_16M) == PDE_ENTRY_16M){
 	return (physaddr_t) (((*pgdir) & 0xFF000000) + (va & 0xFFFFFF));
     }
+    else if ((*pgdir & PDE_ENTRY_1M) == PDE_ENTRY_1M) {
+	return (physaddr_t) (((*pgdir) & 0xFFF00000) + (va & 0xFFFFF));
+    }
     else {
 	p = (pte_t*) KADDR(PDE_ADDR(*pgdir));
 	if (!(p[PTX(va)] & PTE_P))
@@ -379,7 +1264,7 @@ static physaddr_t check_va2pa(pde_t *pgdir, uintptr_t va)
 check_page(void)
 {
        struct PageInfo *pp, *pp0, *pp1, *pp2;
-       struct PageInfo *fl;
+       struct FreeStash fl;
        pte_t *ptep, *ptep1;
        void *va;
        int i;
@@ -396,8 +1281,7 @@ check_page(void)
     assert(pp2 && pp2 != pp1 && pp2 != pp0);
 
     // temporarily steal the rest of the free pages
-    fl = page_free_list;
-    page_free_list = 0;
+    check_steal_free(&fl);
 
     // should be no free memory
     assert(!page_alloc(0));
@@ -411,7 +1295,8 @@ check_page(void)
     // free pp0 and try again: pp0 should be used for page table
     page_free(pp0);
     assert(page_insert(kern_pgdir, pp1, 0x0, PTE_NONE_U) == 0);
-    assert(PTE_SMALL_ADDR(kern_pgdir[0]) == page2pa(pp0));
+    assert(PDE_ADDR(kern_pgdir[0]) == page2pa(pp0));
+    assert(pp0->pp_flags & PP_PGTBL);
     assert(check_va2pa(kern_pgdir, 0x0) == page2pa(pp1));
     assert(pp1->pp_ref == 1);
     assert(pp0->pp_ref == 1);
@@ -449,8 +1334,19 @@ check_page(void)
     assert(*pgdir_walk(kern_pgdir, (void*) PGSIZE, 0) & PTE_NONE_U);
     assert((*pgdir_walk(kern_pgdir, (void*) PGSIZE, 0) & PTE_RW_U) != PTE_RW_U);
 
-    // should not be able to map at PTSIZE because need free page for page table
-    assert(page_insert(kern_pgdir, pp0, (void*) PTSIZE, PTE_NONE_U) < 0);
+    // should be able to map at PTSIZE without a free page: its page
+    // table is the second quarter of pp0
+    assert(page_insert(kern_pgdir, pp2, (void*) PTSIZE, PTE_NONE_U) == 0);
+    assert(PDE_ADDR(kern_pgdir[PDX(PTSIZE)]) == page2pa(pp0) + NPTENTRIES * sizeof(pte_t));
+    assert(pp0->pp_ref == 2);
+    assert(pp2->pp_ref == 2);
+
+    // unmapping the only page in that table frees the table
+    page_remove(kern_pgdir, (void*) PTSIZE);
+    assert(kern_pgdir[PDX(PTSIZE)] == 0);
+    assert(pp0->pp_ref == 1);
+    assert(pp2->pp_ref == 1);
+    assert(!page_alloc(0));
 
     // insert pp1 at PGSIZE (replacing pp2)
     assert(page_insert(kern_pgdir, pp1, (void*) PGSIZE, PTE_NONE_U) == 0);
@@ -478,49 +1374,51 @@ check_page(void)
     assert(pp1->pp_ref);
     assert(pp1->pp_link == NULL);
 
-    // unmapping pp1 at PGSIZE should free it
+    // unmapping pp1 at PGSIZE should free it, and with it the now
+    // empty page table in pp0
     page_remove(kern_pgdir, (void*) PGSIZE);
     assert(check_va2pa(kern_pgdir, 0x0) == ~0);
     assert(check_va2pa(kern_pgdir, PGSIZE) == ~0);
+    assert(kern_pgdir[0] == 0);
     assert(pp1->pp_ref == 0);
     assert(pp2->pp_ref == 0);
+    assert(pp0->pp_ref == 0);
+    assert(!(pp0->pp_flags & PP_PGTBL));
 
-    // so it should be returned by page_alloc
-    assert((pp = page_alloc(0)) && pp == pp1);
+    // so both should be returned by page_alloc
+    assert((pp = page_alloc(0)) && (pp == pp0 || pp == pp1));
+    assert((pp = page_alloc(0)) && (pp == pp0 || pp == pp1));
 
     // should be no free memory
     assert(!page_alloc(0));
 
-    // forcibly take pp0 back
-    assert(PTE_SMALL_ADDR(kern_pgdir[0]) == page2pa(pp0));
-    kern_pgdir[0] = 0;
-    assert(pp0->pp_ref == 1);
-    pp0->pp_ref = 0;
-
     // check pointer arithmetic in pgdir_walk
     page_free(pp0);
     va = (void*)(PGSIZE * NPDENTRIES + PGSIZE);
     ptep = pgdir_walk(kern_pgdir, va, 1);
-    ptep1 = (pte_t *) KADDR(PTE_SMALL_ADDR(kern_pgdir[PDX(va)]));
+    ptep1 = (pte_t *) KADDR(PDE_ADDR(kern_pgdir[PDX(va)]));
     assert(ptep == ptep1 + PTX(va));
-    kern_pgdir[PDX(va)] = 0;
-    pp0->pp_ref = 0;
+
+    // removing a page from an empty table frees the table too
+    page_remove(kern_pgdir, va);
+    assert(kern_pgdir[PDX(va)] == 0);
+    assert(pp0->pp_ref == 0 && (pp0->pp_flags & PP_FREE));
 
     // check that new page tables get cleared
+    assert((pp = page_alloc(0)) && pp == pp0);
     memset(page2kva(pp0), 0xFF, PGSIZE);
     page_free(pp0);
     pgdir_walk(kern_pgdir, 0x0, 1);
     ptep = (pte_t *) page2kva(pp0);
     for(i=0; i<NPTENTRIES; i++)
 	assert((ptep[i] & PTE_P) == 0);
-    kern_pgdir[0] = 0;
-    pp0->pp_ref = 0;
+    page_remove(kern_pgdir, 0x0);
+    assert(kern_pgdir[0] == 0);
 
     // give free list back
-    page_free_list = fl;
+    check_return_free(&fl);
 
-    // free the pages we took
-    page_free(pp0);
+    // free the pages we took; pp0 went back with its page table
     page_free(pp1);
     page_free(pp2);
 
@@ -532,7 +1430,6 @@ check_page(void)
 check_page_installed_pgdir(void)
 {
     struct PageInfo *pp, *pp0, *pp1, *pp2;
-    struct PageInfo *fl;
     pte_t *ptep, *ptep1;
     uintptr_t va;
     int i;
@@ -557,14 +1454,219 @@ check_page_installed_pgdir(void)
     page_remove(kern_pgdir, (void*) PGSIZE);
     assert(pp2->pp_ref == 0);
 
-    // forcibly take pp0 back
-    assert(PTE_SMALL_ADDR(kern_pgdir[0]) == page2pa(pp0));
-    kern_pgdir[0] = 0;
-    assert(pp0->pp_ref == 1);
-    pp0->pp_ref = 0;
+    // the page table went away with its last mapping
+    assert(kern_pgdir[0] == 0);
 
-    // free the pages we took
+    cprintf("check_page_installed_pgdir() succeeded!\n");
+}
+
+// check map_region's choice of descriptors, and splitting on remap
+    static void
+check_map_region(void)
+{
+    uintptr_t va = 0x10000000, va2;	// nothing is mapped there
+    physaddr_t pa = 0x20000000;
+    size_t size = SUPSIZE + PTSIZE + LPGSIZE + PGSIZE, off;
+    int nfree = check_count_free();
+    struct PageInfo *pp, *pp0, *ppg[LPGSIZE / PGSIZE];
+    pde_t *pd;
+    pte_t *ptep;
+    int i;
+
+    // one of each descriptor size, largest first
+    map_region(kern_pgdir, va, size, pa, PTE_NONE_U | PTE_CACHED);
+    assert((kern_pgdir[PDX(va)] & PDE_ENTRY_16M) == PDE_ENTRY_16M);
+    assert(kern_pgdir[PDX(va) + 15] == kern_pgdir[PDX(va)]);
+    assert(section_to_attr(kern_pgdir[PDX(va)]) == (PTE_NONE_U | PTE_CACHED));
+    assert(pde_is_section(kern_pgdir[PDX(va + SUPSIZE)]));
+    assert(!(kern_pgdir[PDX(va + SUPSIZE)] & PDE_SUPER));
+    ptep = pgdir_walk(kern_pgdir, (void *) (va + SUPSIZE + PTSIZE), 0);
+    assert(ptep && pte_is_large(ptep[0]) && ptep[15] == ptep[0]);
+    assert(large_to_attr(ptep[0]) == (PTE_NONE_U | PTE_CACHED));
+    assert((ptep[16] & PTE_ENTRY_SMALL) && !(ptep[17] & PTE_P));
+    for (off = 0; off < size; off += PGSIZE)
+	assert(check_va2pa(kern_pgdir, va + off) == pa + off);
+
+    // remapping one page inside the supersection splits it down to a
+    // small page, and leaves the rest of the range as it was
+    va2 = va + PTSIZE + LPGSIZE + PGSIZE;
+    map_region(kern_pgdir, va2, PGSIZE, 0x30000000, PTE_RW_U);
+    assert(check_va2pa(kern_pgdir, va2) == 0x30000000);
+    for (off = 0; off < size; off += PGSIZE)
+	if (va + off != va2)
+	    assert(check_va2pa(kern_pgdir, va + off) == pa + off);
+    assert(pde_is_section(kern_pgdir[PDX(va)]));
+    assert(!(kern_pgdir[PDX(va)] & PDE_SUPER));
+    ptep = pgdir_walk(kern_pgdir, (void *) (va + PTSIZE), 0);
+    assert(ptep && pte_is_large(ptep[0]) && pte_is_large(ptep[32]));
+    assert(!pte_is_large(ptep[16]) && !pte_is_large(ptep[17]));
+    assert(large_to_attr(ptep[0]) == (PTE_NONE_U | PTE_CACHED));
+    assert((ptep[17] & PTE_RW_U) == PTE_RW_U);
+
+    // page_insert() refuses a large page or a section, and the other
+    // page-level calls leave one as it is, never touching the reference
+    // count of the frame behind it
+    assert((pp = page_alloc_order(4, 0)));
+    assert((pp0 = page_alloc(0)));
+    va2 = va + PTSIZE + 2 * LPGSIZE;
+    map_region(kern_pgdir, va2, LPGSIZE, page2pa(pp), PTE_NONE_U | PTE_CACHED);
+    assert(page_insert(kern_pgdir, pp0, (void *) (va2 + PGSIZE), PTE_NONE_U) == -E_INVAL);
+    assert(page_insert(kern_pgdir, pp0, (void *) va, PTE_NONE_U) == -E_INVAL);
+    assert(pde_is_section(kern_pgdir[PDX(va)]));
+    assert(pp0->pp_ref == 0);
+    assert(page_lookup(kern_pgdir, (void *) va2, &ptep) == NULL);
+    assert(ptep && pte_is_large(*ptep));
+    for (off = 0; off < LPGSIZE; off += PGSIZE)
+	page_remove(kern_pgdir, (void *) (va2 + off));
+    page_remove_range(kern_pgdir, (void *) (va2 + PGSIZE), LPGSIZE);
+    assert(pp->pp_ref == 0);
+    for (off = 0; off < LPGSIZE; off += PGSIZE)
+	assert(check_va2pa(kern_pgdir, va2 + off) == page2pa(pp) + off);
+    assert(check_va2pa(kern_pgdir, va2 + LPGSIZE) == pa + PTSIZE + 3 * LPGSIZE);
     page_free(pp0);
 
-    cprintf("check_page_installed_pgdir() succeeded!\n");
+    // tear it down; every page table goes back
+    for (off = 0; off < size; off += PTSIZE)
+	pde_clear(&kern_pgdir[PDX(va + off)]);
+    tlb_invalidate_all();
+    page_free_order(pp, 4);
+    assert(check_count_free() == nfree);
+
+    // a user page directory holds only counted small pages, so removing
+    // a page and then its neighbours, and destroying the directory,
+    // brings every count back to zero
+    assert((pd = pgdir_create()));
+    for (i = 0; i < LPGSIZE / PGSIZE; i++) {
+	assert((ppg[i] = page_alloc(0)));
+	assert(page_insert(pd, ppg[i], (void *) (UTEXT + i * PGSIZE), PTE_RW_U) == 0);
+    }
+    page_remove(pd, (void *) UTEXT);
+    page_remove(pd, (void *) (UTEXT + PGSIZE));
+    page_remove_range(pd, (void *) (UTEXT + 8 * PGSIZE), 2 * PGSIZE);
+    assert(ppg[0]->pp_ref == 0 && ppg[1]->pp_ref == 0 && ppg[2]->pp_ref == 1);
+    assert(ppg[8]->pp_ref == 0 && ppg[9]->pp_ref == 0 && ppg[10]->pp_ref == 1);
+    pgdir_destroy(pd);
+    for (i = 0; i < LPGSIZE / PGSIZE; i++)
+	assert(ppg[i]->pp_ref == 0);
+    assert(check_count_free() == nfree);
+
+    cprintf("check_map_region() succeeded!\n");
+}
+
+// check that user address spaces are kept apart by their ASIDs
+    static void
+check_asid(void)
+{
+    volatile uint32_t *uva = (uint32_t *) UTEXT;
+    struct PageInfo *pp1, *pp2;
+    pde_t *pd1, *pd2, *pd3;
+    int nfree = check_count_free(), a1, a2;
+
+    assert((pp1 = page_alloc(0)) && (pp2 = page_alloc(0)));
+    *(uint32_t *) page2kva(pp1) = 0x11111111;
+    *(uint32_t *) page2kva(pp2) = 0x22222222;
+    assert((pd1 = pgdir_create()) && (pd2 = pgdir_create()));
+    assert(PADDR(pd1) % (NUPDENTRIES * sizeof(pde_t)) == 0);
+    assert(page_insert(pd1, pp1, (void *) uva, PTE_NONE_U) == 0);
+    assert(page_insert(pd2, pp2, (void *) uva, PTE_NONE_U) == 0);
+    assert(*pgdir_walk(pd1, (void *) uva, 0) & PTE_NG);
+
+    // switching needs no flush: each space sees its own page
+    pgdir_switch(pd1);
+    assert(*uva == 0x11111111);
+    pgdir_switch(pd2);
+    assert(*uva == 0x22222222);
+    a1 = pgdir_asid(pd1);
+    a2 = pgdir_asid(pd2);
+    assert(a1 != KERN_ASID && a2 != KERN_ASID && a1 != a2);
+    pgdir_switch(pd1);
+    assert(*uva == 0x11111111 && pgdir_asid(pd1) == a1);
+
+    // running out of ASIDs starts a new generation, and old spaces
+    // get new ASIDs when they next run
+    asid_next = ASID_MASK + 1;
+    assert((pd3 = pgdir_create()));
+    pgdir_switch(pd3);
+    assert(pgdir_asid(pd3) == KERN_ASID + 1);
+    assert(pgdir_asid(pd1) == -1 && pgdir_asid(pd2) == -1);
+    pgdir_switch(pd2);
+    assert(*uva == 0x22222222 && pgdir_asid(pd2) == KERN_ASID + 2);
+    pgdir_switch(pd1);
+    assert(*uva == 0x11111111);
+
+    // unmapping in one space leaves the other alone
+    page_remove(pd1, (void *) uva);
+    assert(pp1->pp_ref == 0);
+    pgdir_switch(pd2);
+    assert(*uva == 0x22222222);
+
+    pgdir_switch(kern_pgdir);
+    pgdir_destroy(pd1);
+    pgdir_destroy(pd2);
+    pgdir_destroy(pd3);
+    assert(pp2->pp_ref == 0);
+    assert(check_count_free() == nfree);
+
+    cprintf("check_asid() succeeded!\n");
+}
+
+// check page_remove_range and the batched TLB flush behind it
+    static void
+check_page_remove_range(void)
+{
+    // straddles two page tables
+    uintptr_t va = UTEXT + PTSIZE - 2 * PGSIZE;
+    static const int counts[] = { 4, 40 };
+    struct PageInfo *pp[40], *pp0;
+    int nfree = check_count_free(), i, k, n;
+    pde_t *pd;
+
+    assert(40 > tlb_gather_threshold);
+    assert((pd = pgdir_create()));
+    pgdir_switch(pd);
+
+    // below and above the full-flush threshold
+    for (k = 0; k < 2; k++) {
+	n = counts[k];
+	for (i = 0; i < n; i++) {
+	    assert((pp[i] = page_alloc(0)));
+	    *(uint32_t *) page2kva(pp[i]) = i + 1;
+	    assert(page_insert(pd, pp[i], (void *) (va + i * PGSIZE), PTE_NONE_U) == 0);
+	}
+	for (i = 0; i < n; i++)
+	    assert(*(volatile uint32_t *) (va + i * PGSIZE) == i + 1);
+
+	page_remove_range(pd, (void *) va, n * PGSIZE);
+	for (i = 0; i < n; i++)
+	    assert(pp[i]->pp_ref == 0);
+	assert(pd[PDX(va)] == 0 && pd[PDX(va + n * PGSIZE - 1)] == 0);
+
+	// the old translations are gone from the TLB
+	assert((pp0 = page_alloc(0)));
+	*(uint32_t *) page2kva(pp0) = 0xdeadbeef;
+	assert(page_insert(pd, pp0, (void *) va, PTE_NONE_U) == 0);
+	assert(page_insert(pd, pp0, (void *) (va + (n - 1) * PGSIZE), PTE_NONE_U) == 0);
+	assert(*(volatile uint32_t *) va == 0xdeadbeef);
+	assert(*(volatile uint32_t *) (va + (n - 1) * PGSIZE) == 0xdeadbeef);
+	page_remove_range(pd, (void *) va, n * PGSIZE);
+	assert(pp0->pp_ref == 0);
+    }
+
+    // a partial range leaves its neighbours mapped
+    for (i = 0; i < 3; i++) {
+	assert((pp[i] = page_alloc(0)));
+	assert(page_insert(pd, pp[i], (void *) (va + i * PGSIZE), PTE_NONE_U) == 0);
+    }
+    page_remove_range(pd, (void *) (va + PGSIZE), PGSIZE);
+    assert(pp[0]->pp_ref == 1 && pp[1]->pp_ref == 0 && pp[2]->pp_ref == 1);
+    assert(page_lookup(pd, (void *) (va + PGSIZE), 0) == NULL);
+    assert(page_lookup(pd, (void *) (va + 2 * PGSIZE), 0) == pp[2]);
+    page_remove_range(pd, (void *) va, 3 * PGSIZE);
+    assert(pp[0]->pp_ref == 0 && pp[2]->pp_ref == 0);
+
+    pgdir_switch(kern_pgdir);
+    pgdir_destroy(pd);
+    assert(check_count_free() == nfree);
+
+    cprintf("check_page_remove_range() succeeded!\n");
 }
@@ -11,13 +11,13 @@
 
 extern char bootstacktop[], bootstack[];
 
-extern struct PageInfo pages[];
+extern struct PageInfo *pages;
 extern size_t npages;
 
 extern pde_t kern_pgdir[];
 
 /* This macro takes a kernel virtual address -- an address that points above
- * KERNBASE, where the machine's maximum 256MB of physical memory is mapped --
+ * KERNBASE, where the machine's maximum 1GB of physical memory is mapped --
  * and returns the corresponding physical address.  It panics if you pass it a
  * non-kernel virtual address.
  */
@@ -49,17 +49,69 @@ enum {
 	ALLOC_ZERO = 1<<0,
 };
 
-void	mem_init(void);
+enum {
+	// Page heads a free buddy block of 2^pp_order pages.
+	PP_FREE = 1<<0,
+	// Page belongs to a slab; pp_link points to the slab's first page.
+	PP_SLAB = 1<<1,
+	// Page heads a block of 2^pp_order pages returned by kmalloc().
+	PP_KMALLOC = 1<<2,
+	// Page holds L2 page tables; pp_ref counts the tables in use.
+	PP_PGTBL = 1<<3,
+	// Page heads a user page directory; pp_asid holds its ASID.
+	PP_PGDIR = 1<<4,
+};
+
+// Largest block the buddy allocator manages: 2^PAGE_MAX_ORDER pages,
+// i.e. 16MB, the size of a supersection.
+#define PAGE_MAX_ORDER	12
+
+void	mem_init(physaddr_t bootinfo);
 
 void	page_init(void);
 struct PageInfo *page_alloc(int alloc_flags);
 void	page_free(struct PageInfo *pp);
+struct PageInfo *page_alloc_order(int order, int alloc_flags);
+void	page_free_order(struct PageInfo *pp, int order);
 int	page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm);
 void	page_remove(pde_t *pgdir, void *va);
+void	page_remove_range(pde_t *pgdir, void *va, size_t len);
 struct PageInfo *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
 void	page_decref(struct PageInfo *pp);
 
-void	tlb_invalidate(pde_t *pgdir, void *va);
+void	map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int attr);
+
+// A user page directory only has the entries below USERTOP.
+#define NUPDENTRIES	PDX(USERTOP)
+
+pde_t	*pgdir_create(void);
+pde_t	*pgdir_dup(pde_t *src);
+void	pgdir_destroy(pde_t *pgdir);
+void	pgdir_switch(pde_t *pgdir);
+int	pgdir_asid(pde_t *pgdir);
+
+// The ASID kern_pgdir runs with.  No user address space gets it.
+#define KERN_ASID	0
+
+void	tlb_invalidate(int asid, void *va);
+void	tlb_invalidate_asid(int asid);
+void	tlb_invalidate_all(void);
+
+// Queue the pages whose mappings change, then flush them together.
+#define TLB_GATHER_MAX	64
+
+struct TlbGather {
+	int tg_asid;			// from pgdir_asid()
+	int tg_n;			// entries in tg_va
+	bool tg_full;			// too many: flush the whole ASID
+	uintptr_t tg_va[TLB_GATHER_MAX];
+};
+
+extern int tlb_gather_threshold;
+
+void	tlb_gather_init(struct TlbGather *tg, pde_t *pgdir);
+void	tlb_gather_add(struct TlbGather *tg, void *va);
+void	tlb_gather_flush(struct TlbGather *tg);
 
 static inline physaddr_t
 page2pa(struct PageInfo *pp)
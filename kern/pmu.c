@@ -0,0 +1,300 @@
+// Performance monitor: the cycle counter, hardware event counters,
+// counted code regions and the "pmu" monitor command.
+//
+// The ARM1176 counts two events at a time besides cycles; the ARMv7
+// PMU of the Cortex-A7 counts four.  Events are chosen by name with
+// pmu_select() ("pmu events ..." in the monitor), and each model
+// maps the name to its own event number.
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/error.h>
+#include <inc/arm.h>
+
+#include <kern/pmu.h>
+#include <kern/time.h>
+#include <kern/trap.h>
+#include <kern/monitor.h>
+
+// ARM1176 PMNC: enable, reset the cycle counter, and the event
+// numbers of PMN0 and PMN1.
+#define PMNC_E		(1 << 0)
+#define PMNC_C		(1 << 2)
+#define PMNC_EVT0(e)	((e) << 20)
+#define PMNC_EVT1(e)	((e) << 12)
+
+// ARMv7 PMCR: enable, reset the cycle counter, and the number of
+// event counters.
+#define PMCR_E		(1 << 0)
+#define PMCR_C		(1 << 2)
+#define PMCR_N(pmcr)	(((pmcr) >> 11) & 0x1F)
+#define PMCNTEN_C	(1U << 31)
+
+#define PMU_NREGION	32
+
+int pmu_model;
+int pmu_ncounters;
+
+struct PmuEvent {
+	const char *pe_name;
+	const char *pe_desc;
+	int pe_v6;		// ARM1176 event number, or -1
+	int pe_v7;		// ARMv7 event number, or -1
+};
+
+static const struct PmuEvent pmu_events[] = {
+	{ "instr",   "instructions executed",		0x07, 0x08 },
+	{ "daccess", "data cache accesses",		0x09, 0x04 },
+	{ "dmiss",   "data cache misses",		0x0B, 0x03 },
+	{ "imiss",   "instruction cache misses",	0x00, 0x01 },
+	{ "dtlb",    "data (micro) TLB misses",		0x04, 0x05 },
+	{ "itlb",    "instruction (micro) TLB misses",	0x03, 0x02 },
+	{ "tlb",     "main TLB misses",			0x0F, -1 },
+	{ "branch",  "branches executed",		0x05, 0x12 },
+	{ "bmiss",   "branches mispredicted",		0x06, 0x10 },
+};
+#define NEVENTS (sizeof(pmu_events) / sizeof(pmu_events[0]))
+
+// The events the counters are counting, in counter order.
+static const struct PmuEvent *pmu_selected[PMU_NCOUNTER];
+
+static struct PmuRegion pmu_regions[PMU_NREGION];
+static int pmu_nregions;
+
+static const struct PmuEvent *
+pmu_event(const char *name)
+{
+	int i, code;
+
+	for (i = 0; i < NEVENTS; i++) {
+		if (strcmp(pmu_events[i].pe_name, name) != 0)
+			continue;
+		code = pmu_model == PMU_V6 ? pmu_events[i].pe_v6
+					   : pmu_events[i].pe_v7;
+		return code >= 0 ? &pmu_events[i] : NULL;
+	}
+	return NULL;
+}
+
+// Count the events 'names' on the first 'n' counters, and clear the
+// region totals, which counted the old ones.  Returns -E_INVAL for an
+// event this PMU cannot count or more events than counters.
+int
+pmu_select(int n, const char * const *names)
+{
+	const struct PmuEvent *ev[PMU_NCOUNTER];
+	uint32_t pmnc;
+	int i;
+
+	if (n > pmu_ncounters)
+		return -E_INVAL;
+	for (i = 0; i < n; i++)
+		if (!(ev[i] = pmu_event(names[i])))
+			return -E_INVAL;
+
+	memset(pmu_selected, 0, sizeof(pmu_selected));
+	for (i = 0; i < n; i++)
+		pmu_selected[i] = ev[i];
+
+	if (pmu_model == PMU_V6) {
+		// An unused counter counts cycles, harmlessly.
+		pmnc = PMNC_E;
+		pmnc |= PMNC_EVT0(n > 0 ? ev[0]->pe_v6 : 0xFF);
+		pmnc |= PMNC_EVT1(n > 1 ? ev[1]->pe_v6 : 0xFF);
+		asm volatile("mcr p15, 0, %0, c15, c12, 0" : : "r" (pmnc));
+	} else if (pmu_model == PMU_V7) {
+		for (i = 0; i < n; i++) {
+			asm volatile("mcr p15, 0, %0, c9, c12, 5" : : "r" (i));
+			isb();
+			asm volatile("mcr p15, 0, %0, c9, c13, 1"
+				     : : "r" (ev[i]->pe_v7));
+		}
+		asm volatile("mcr p15, 0, %0, c9, c12, 2"
+			     : : "r" (~PMCNTEN_C & ((1U << pmu_ncounters) - 1)));
+		asm volatile("mcr p15, 0, %0, c9, c12, 1"
+			     : : "r" (PMCNTEN_C | ((1U << n) - 1)));
+	}
+
+	for (i = 0; i < pmu_nregions; i++) {
+		pmu_regions[i].pr_calls = 0;
+		pmu_regions[i].pr_cycles = 0;
+		memset(pmu_regions[i].pr_event, 0, sizeof(pmu_regions[i].pr_event));
+	}
+	return 0;
+}
+
+// Snapshot the cycle counter and every counter, used or not; only
+// differences mean anything.
+void
+pmu_read(struct PmuCounts *pc)
+{
+	int i;
+
+	pc->pc_cycles = cycles();
+	if (pmu_model == PMU_V6) {
+		asm volatile("mrc p15, 0, %0, c15, c12, 2" : "=r" (pc->pc_event[0]));
+		asm volatile("mrc p15, 0, %0, c15, c12, 3" : "=r" (pc->pc_event[1]));
+	} else if (pmu_model == PMU_V7) {
+		for (i = 0; i < pmu_ncounters; i++) {
+			asm volatile("mcr p15, 0, %0, c9, c12, 5" : : "r" (i));
+			isb();
+			asm volatile("mrc p15, 0, %0, c9, c13, 2"
+				     : "=r" (pc->pc_event[i]));
+		}
+	}
+}
+
+// The totals for region 'name', created on first use.  Returns NULL
+// once PMU_NREGION names are in use; such regions go uncounted.
+struct PmuRegion *
+pmu_region_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < pmu_nregions; i++)
+		if (strcmp(pmu_regions[i].pr_name, name) == 0)
+			return &pmu_regions[i];
+	if (pmu_nregions == PMU_NREGION)
+		return NULL;
+	pmu_regions[pmu_nregions].pr_name = name;
+	return &pmu_regions[pmu_nregions++];
+}
+
+void
+pmu_region_end(struct PmuRegion *pr, const struct PmuCounts *begin)
+{
+	struct PmuCounts end;
+	int i;
+
+	if (!pr)
+		return;
+	pmu_read(&end);
+	pr->pr_calls++;
+	pr->pr_cycles += end.pc_cycles - begin->pc_cycles;
+	for (i = 0; i < pmu_ncounters; i++)
+		pr->pr_event[i] += end.pc_event[i] - begin->pc_event[i];
+}
+
+void
+pmu_init(void)
+{
+	static const char * const defaults[] = {
+		"instr", "dmiss", "dtlb", "bmiss",
+	};
+	uint32_t midr, dfr0, val;
+
+	asm volatile("mrc p15, 0, %0, c0, c0, 0" : "=r" (midr));
+	asm volatile("mrc p15, 0, %0, c0, c1, 2" : "=r" (dfr0));
+
+	if (((midr >> 4) & 0xFFF) == 0xB76) {
+		// ARM1176.  Emulators may not model its PMU, so probe.
+		trap_probe = 1;
+		asm volatile("mcr p15, 0, %0, c15, c12, 0"
+			     : : "r" (PMNC_E | PMNC_C) : "memory");
+		if (trap_probe) {
+			pmu_model = PMU_V6;
+			pmu_ncounters = 2;
+		}
+		trap_probe = 0;
+	} else if (((dfr0 >> 24) & 0xF) >= 2 && ((dfr0 >> 24) & 0xF) != 0xF) {
+		asm volatile("mrc p15, 0, %0, c9, c12, 0" : "=r" (val));
+		asm volatile("mcr p15, 0, %0, c9, c12, 0"
+			     : : "r" (val | PMCR_E | PMCR_C));
+		asm volatile("mcr p15, 0, %0, c9, c12, 1" : : "r" (PMCNTEN_C));
+		pmu_model = PMU_V7;
+		pmu_ncounters = MIN(PMCR_N(val), PMU_NCOUNTER);
+	}
+
+	pmu_select(MIN(pmu_ncounters, 4), defaults);
+}
+
+
+// --------------------------------------------------------------
+// The pmu monitor command.
+// --------------------------------------------------------------
+
+static void
+pmu_print_events(void)
+{
+	int i;
+
+	cprintf("counting cycles");
+	for (i = 0; i < pmu_ncounters && pmu_selected[i]; i++)
+		cprintf(", %s", pmu_selected[i]->pe_name);
+	cprintf(" (%d counters)\n", pmu_ncounters);
+	if (pmu_ncounters == 0)
+		return;
+	cprintf("events:\n");
+	for (i = 0; i < NEVENTS; i++)
+		if (pmu_event(pmu_events[i].pe_name))
+			cprintf("  %-8s %s\n", pmu_events[i].pe_name,
+				pmu_events[i].pe_desc);
+}
+
+static void
+pmu_print_header(const char *first, const char *second)
+{
+	int i;
+
+	cprintf("%-16s %8s %10s", first, second, "cycles");
+	for (i = 0; i < pmu_ncounters && pmu_selected[i]; i++)
+		cprintf(" %10s", pmu_selected[i]->pe_name);
+	cprintf("\n");
+}
+
+// Average counts for one pass through each region.
+static void
+pmu_print_regions(void)
+{
+	struct PmuRegion *pr;
+	int i, j;
+
+	pmu_print_header("region", "calls");
+	for (i = 0; i < pmu_nregions; i++) {
+		pr = &pmu_regions[i];
+		if (!pr->pr_calls)
+			continue;
+		cprintf("%-16s %8u %10llu", pr->pr_name, pr->pr_calls,
+			pr->pr_cycles / pr->pr_calls);
+		for (j = 0; j < pmu_ncounters && pmu_selected[j]; j++)
+			cprintf(" %10llu", pr->pr_event[j] / pr->pr_calls);
+		cprintf("\n");
+	}
+}
+
+int
+mon_pmu(int argc, char **argv, struct Trapframe *tf)
+{
+	struct PmuCounts begin, end;
+	int i, r;
+
+	if (argc < 2) {
+		cprintf("usage: pmu <cmd...>        run a command, print counts\n"
+			"       pmu events [name...] show or select events\n"
+			"       pmu regions          counts per PMU_REGION\n");
+		pmu_print_events();
+		return 0;
+	}
+	if (strcmp(argv[1], "events") == 0) {
+		if (argc > 2 && (r = pmu_select(argc - 2,
+						(const char * const *) argv + 2)) < 0)
+			cprintf("pmu: cannot count those events: %e\n", r);
+		pmu_print_events();
+		return 0;
+	}
+	if (strcmp(argv[1], "regions") == 0) {
+		pmu_print_regions();
+		return 0;
+	}
+
+	pmu_read(&begin);
+	r = monitor_exec(argc - 1, argv + 1, tf);
+	pmu_read(&end);
+	pmu_print_header("command", "");
+	cprintf("%-16s %8s %10u", argv[1], "", end.pc_cycles - begin.pc_cycles);
+	for (i = 0; i < pmu_ncounters && pmu_selected[i]; i++)
+		cprintf(" %10u", end.pc_event[i] - begin.pc_event[i]);
+	cprintf("\n");
+	return r;
+}
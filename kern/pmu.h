@@ -0,0 +1,58 @@
+#ifndef JOS_KERN_PMU_H
+#define JOS_KERN_PMU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Which performance monitor the CPU has.
+enum {
+	PMU_NONE,	// none: cycles() falls back to the clock counter
+	PMU_V6,		// ARM11: CCNT and two event counters (CP15 c15)
+	PMU_V7,		// ARMv7: PMCCNTR and up to 31 event counters (CP15 c9)
+};
+
+// Event counters the kernel uses at most, whatever the CPU has.
+#define PMU_NCOUNTER	4
+
+extern int pmu_model;
+extern int pmu_ncounters;
+
+// A snapshot of the cycle counter and the selected event counters.
+struct PmuCounts {
+	uint32_t pc_cycles;
+	uint32_t pc_event[PMU_NCOUNTER];
+};
+
+// Counts accumulated by PMU_REGION_BEGIN/END under one name.
+struct PmuRegion {
+	const char *pr_name;
+	uint32_t pr_calls;
+	uint64_t pr_cycles;
+	uint64_t pr_event[PMU_NCOUNTER];
+};
+
+void	pmu_init(void);
+int	pmu_select(int n, const char * const *names);
+void	pmu_read(struct PmuCounts *pc);
+struct PmuRegion *pmu_region_lookup(const char *name);
+void	pmu_region_end(struct PmuRegion *pr, const struct PmuCounts *begin);
+
+// Count the code between PMU_REGION_BEGIN(name) and PMU_REGION_END(name),
+// which must be in the same block, towards the region 'name'.  Every
+// site with the same name adds to the same totals, which "pmu regions"
+// prints.  Each pass costs two counter snapshots.
+#define PMU_REGION_BEGIN(name)						\
+	{								\
+		static struct PmuRegion *__pmu_region;			\
+		struct PmuCounts __pmu_begin;				\
+		if (!__pmu_region)					\
+			__pmu_region = pmu_region_lookup(name);		\
+		pmu_read(&__pmu_begin);
+
+#define PMU_REGION_END(name)						\
+		pmu_region_end(__pmu_region, &__pmu_begin);		\
+	}
+
+#endif	// !JOS_KERN_PMU_H
@@ -1,25 +1,42 @@
 // Simple implementation of cprintf console output for the kernel,
-// based on printfmt() and the kernel console's cputchar().
+// based on printfmt() and the kernel log's dmesg_write().
 
 #include <inc/types.h>
 #include <inc/stdio.h>
 #include <inc/stdarg.h>
 
+#include <kern/dmesg.h>
+
+// Output is collected on the stack and handed to the log a buffer at
+// a time, rather than a character at a time.
+struct printbuf {
+	int idx;	// current buffer index
+	int cnt;	// total bytes printed so far
+	char buf[256];
+};
 
 static void
-putch(int ch, int *cnt)
+putch(int ch, struct printbuf *b)
 {
-	cputchar(ch);
-	(*cnt)++;
+	b->buf[b->idx++] = ch;
+	if (b->idx == sizeof(b->buf)) {
+		dmesg_write(b->buf, b->idx);
+		b->idx = 0;
+	}
+	b->cnt++;
 }
 
 int
 vcprintf(const char *fmt, va_list ap)
 {
-	int cnt = 0;
-
-	vprintfmt((void*)putch, &cnt, fmt, ap);
-	return cnt;
+	struct printbuf b;
+
+	b.idx = 0;
+	b.cnt = 0;
+	vprintfmt((void*)putch, &b, fmt, ap);
+	if (b.idx > 0)
+		dmesg_write(b.buf, b.idx);
+	return b.cnt;
 }
 
 int
@@ -34,4 +51,3 @@ cprintf(const char *fmt, ...)
 
 	return cnt;
 }
-
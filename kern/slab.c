@@ -0,0 +1,485 @@
+// Slab object allocator layered on the buddy page allocator.
+//
+// Each cache hands out fixed-size objects carved from slabs of
+// 2^kc_order contiguous pages.  A slab's header sits at the start of
+// its first page, followed by a uint16_t array threading the free
+// objects together by index, and then the objects.  Keeping the free
+// links out of the objects means an object stays in the state its
+// constructor left it in while it sits on the free list.
+//
+// Every page of a slab is marked PP_SLAB and its pp_link points at the
+// slab's first page, so kfree() can find the owning cache from nothing
+// but the object's address.
+
+#include <inc/types.h>
+#include <inc/assert.h>
+#include <inc/string.h>
+#include <inc/stdio.h>
+#include <inc/memlayout.h>
+
+#include <kern/pmap.h>
+#include <kern/cache.h>
+#include <kern/slab.h>
+
+// Largest slab; objects big enough to need more go to kmalloc's
+// page path instead.
+#define SLAB_MAX_ORDER	3
+
+// Terminates a slab's free-index chain.
+#define SLAB_END	0xFFFF
+
+struct Slab {
+	struct KmemCache *sl_cache;
+	struct Slab *sl_next;		// on one of the cache's slab lists
+	struct Slab *sl_prev;
+	char *sl_mem;			// first object
+	uint16_t sl_inuse;		// objects allocated from this slab
+	uint16_t sl_free;		// index of the first free object
+	uint16_t sl_freelist[0];	// next free index, per free object
+};
+
+struct KmemCache *kmem_caches;
+
+// The cache that struct KmemCaches themselves come from.
+static struct KmemCache kmem_cache_cache;
+
+// kmalloc size classes, KMALLOC_MIN through KMALLOC_MAX.
+#define NKMALLOC	7
+
+static struct KmemCache *kmalloc_caches[NKMALLOC];
+static const char *kmalloc_names[NKMALLOC] = {
+	"kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256",
+	"kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+static void check_kmem(void);
+static void slab_destroy(struct Slab *s);
+
+//
+// Slab lists.
+//
+
+static void
+slab_list_add(struct Slab **head, struct Slab *s)
+{
+	s->sl_prev = NULL;
+	s->sl_next = *head;
+	if (*head)
+		(*head)->sl_prev = s;
+	*head = s;
+}
+
+static void
+slab_list_remove(struct Slab **head, struct Slab *s)
+{
+	if (s->sl_prev)
+		s->sl_prev->sl_next = s->sl_next;
+	else
+		*head = s->sl_next;
+	if (s->sl_next)
+		s->sl_next->sl_prev = s->sl_prev;
+	s->sl_next = s->sl_prev = NULL;
+}
+
+//
+// Cache setup.
+//
+
+// How many objects of 'size' bytes fit in a slab of 'bytes' bytes
+// once the header and free-index array are in place.  Stores the
+// offset of the first object in *offset.
+static int
+slab_layout(size_t bytes, size_t size, size_t align, size_t *offset)
+{
+	int n;
+
+	n = (bytes - sizeof(struct Slab)) / (size + sizeof(uint16_t));
+	for (; n > 0; n--) {
+		*offset = ROUNDUP(sizeof(struct Slab) + n * sizeof(uint16_t),
+				  align);
+		if (*offset + n * size <= bytes)
+			break;
+	}
+	return n;
+}
+
+static void
+kmem_cache_setup(struct KmemCache *kc, const char *name, size_t size,
+		 size_t align, void (*ctor)(void *))
+{
+	size_t bytes, offset, waste, slack;
+	int order, n;
+
+	if (align == 0)
+		align = dcache_line_size();
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+	assert((align & (align - 1)) == 0);
+	assert(size > 0);
+
+	memset(kc, 0, sizeof(*kc));
+	kc->kc_name = name;
+	kc->kc_objsize = size;
+	kc->kc_align = align;
+	kc->kc_size = ROUNDUP(size, align);
+	kc->kc_reciprocal = ~0U / kc->kc_size + 1;
+	kc->kc_ctor = ctor;
+
+	// Smallest slab that wastes no more than an eighth of itself.
+	// The padding that aligns the first object counts as waste, as
+	// does the slack at the end; only the header is not.
+	for (order = 0; order <= SLAB_MAX_ORDER; order++) {
+		bytes = PGSIZE << order;
+		n = slab_layout(bytes, kc->kc_size, align, &offset);
+		if (n <= 0)
+			continue;
+		slack = bytes - offset - n * kc->kc_size;
+		waste = bytes - n * kc->kc_size
+			- (sizeof(struct Slab) + n * sizeof(uint16_t));
+		if (waste * 8 <= bytes || order == SLAB_MAX_ORDER)
+			break;
+	}
+	if (order > SLAB_MAX_ORDER || n <= 0)
+		panic("kmem_cache_setup: %s: %u-byte objects do not fit a slab",
+		      name, kc->kc_size);
+	assert(n < SLAB_END);
+
+	kc->kc_order = order;
+	kc->kc_perslab = n;
+	kc->kc_offset = offset;
+	// Spare bytes at the end of a slab shift where its objects start,
+	// so the same object in different slabs maps to different lines.
+	kc->kc_color_max = ROUNDDOWN(slack, align);
+
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+}
+
+struct KmemCache *
+kmem_cache_create(const char *name, size_t size, size_t align,
+		  void (*ctor)(void *))
+{
+	struct KmemCache *kc;
+
+	if (!(kc = kmem_cache_alloc(&kmem_cache_cache)))
+		return NULL;
+	kmem_cache_setup(kc, name, size, align, ctor);
+	return kc;
+}
+
+// Release a cache whose objects have all been freed.
+void
+kmem_cache_destroy(struct KmemCache *kc)
+{
+	struct KmemCache **kcp;
+
+	if (kc->kc_inuse)
+		panic("kmem_cache_destroy: %s has %u objects in use",
+		      kc->kc_name, kc->kc_inuse);
+	if (kc->kc_empty)
+		slab_destroy(kc->kc_empty);
+
+	for (kcp = &kmem_caches; *kcp != kc; kcp = &(*kcp)->kc_next)
+		assert(*kcp);
+	*kcp = kc->kc_next;
+	kmem_cache_free(&kmem_cache_cache, kc);
+}
+
+//
+// Slabs.
+//
+
+static struct Slab *
+slab_create(struct KmemCache *kc)
+{
+	struct PageInfo *pp;
+	struct Slab *s;
+	int i;
+
+	if (!(pp = page_alloc_order(kc->kc_order, 0)))
+		return NULL;
+	for (i = 0; i < (1 << kc->kc_order); i++) {
+		pp[i].pp_link = pp;
+		pp[i].pp_flags |= PP_SLAB;
+	}
+
+	s = page2kva(pp);
+	s->sl_cache = kc;
+	s->sl_next = s->sl_prev = NULL;
+	s->sl_mem = (char *) s + kc->kc_offset + kc->kc_color_next;
+	s->sl_inuse = 0;
+	s->sl_free = 0;
+	for (i = 0; i < kc->kc_perslab - 1; i++)
+		s->sl_freelist[i] = i + 1;
+	s->sl_freelist[i] = SLAB_END;
+
+	kc->kc_color_next += kc->kc_align;
+	if (kc->kc_color_next > kc->kc_color_max)
+		kc->kc_color_next = 0;
+
+	if (kc->kc_ctor)
+		for (i = 0; i < kc->kc_perslab; i++)
+			kc->kc_ctor(s->sl_mem + i * kc->kc_size);
+
+	kc->kc_nslabs++;
+	return s;
+}
+
+static void
+slab_destroy(struct Slab *s)
+{
+	struct KmemCache *kc = s->sl_cache;
+	struct PageInfo *pp = pa2page(PADDR(s));
+	int i;
+
+	for (i = 0; i < (1 << kc->kc_order); i++) {
+		pp[i].pp_link = NULL;
+		pp[i].pp_flags &= ~PP_SLAB;
+	}
+	page_free_order(pp, kc->kc_order);
+	kc->kc_nslabs--;
+}
+
+// The slab that 'obj' was allocated from.
+static struct Slab *
+obj_slab(const void *obj)
+{
+	struct PageInfo *pp = pa2page(PADDR((void *) obj));
+
+	if (!(pp->pp_flags & PP_SLAB))
+		panic("%08x is not a slab object", obj);
+	return page2kva(pp->pp_link);
+}
+
+//
+// Allocation.
+//
+
+void *
+kmem_cache_alloc(struct KmemCache *kc)
+{
+	struct Slab *s;
+	int idx;
+
+	if ((s = kc->kc_partial) == NULL) {
+		if ((s = kc->kc_empty) != NULL)
+			slab_list_remove(&kc->kc_empty, s);
+		else if ((s = slab_create(kc)) == NULL)
+			return NULL;
+		slab_list_add(&kc->kc_partial, s);
+	}
+
+	idx = s->sl_free;
+	s->sl_free = s->sl_freelist[idx];
+	if (++s->sl_inuse == kc->kc_perslab) {
+		slab_list_remove(&kc->kc_partial, s);
+		slab_list_add(&kc->kc_full, s);
+	}
+
+	kc->kc_inuse++;
+	kc->kc_nalloc++;
+	return s->sl_mem + idx * kc->kc_size;
+}
+
+void
+kmem_cache_free(struct KmemCache *kc, void *obj)
+{
+	struct Slab *s = obj_slab(obj);
+	uint32_t off;
+	int idx;
+
+	if (s->sl_cache != kc)
+		panic("kmem_cache_free: %08x belongs to %s, not %s",
+		      obj, s->sl_cache->kc_name, kc->kc_name);
+
+	// off / kc_size without a divide; exact since off < 2^15.
+	off = (char *) obj - s->sl_mem;
+	idx = ((uint64_t) off * kc->kc_reciprocal) >> 32;
+	if (idx >= kc->kc_perslab || idx * kc->kc_size != off)
+		panic("kmem_cache_free: %s: bad object %08x", kc->kc_name, obj);
+
+	s->sl_freelist[idx] = s->sl_free;
+	s->sl_free = idx;
+	if (s->sl_inuse-- == kc->kc_perslab) {
+		slab_list_remove(&kc->kc_full, s);
+		slab_list_add(&kc->kc_partial, s);
+	}
+	kc->kc_inuse--;
+	kc->kc_nfree++;
+
+	if (s->sl_inuse == 0) {
+		// Keep one empty slab so an alloc/free pair straddling a
+		// slab boundary does not bounce pages through the buddy
+		// allocator; give any further ones back.
+		slab_list_remove(&kc->kc_partial, s);
+		if (kc->kc_empty)
+			slab_destroy(s);
+		else
+			slab_list_add(&kc->kc_empty, s);
+	}
+}
+
+//
+// kmalloc.
+//
+
+void *
+kmalloc(size_t size)
+{
+	struct PageInfo *pp;
+	int order, shift;
+
+	if (size == 0)
+		return NULL;
+	if (size <= KMALLOC_MAX) {
+		shift = size <= KMALLOC_MIN ? 5 : 32 - __builtin_clz(size - 1);
+		return kmem_cache_alloc(kmalloc_caches[shift - 5]);
+	}
+
+	for (order = 0; (PGSIZE << order) < size; order++)
+		if (order == PAGE_MAX_ORDER)
+			return NULL;
+	if (!(pp = page_alloc_order(order, 0)))
+		return NULL;
+	pp->pp_flags |= PP_KMALLOC;
+	pp->pp_order = order;
+	return page2kva(pp);
+}
+
+void
+kfree(void *p)
+{
+	struct PageInfo *pp;
+
+	if (p == NULL)
+		return;
+	pp = pa2page(PADDR(p));
+	if (pp->pp_flags & PP_SLAB) {
+		kmem_cache_free(obj_slab(p)->sl_cache, p);
+		return;
+	}
+	if (!(pp->pp_flags & PP_KMALLOC) || PGOFF(p))
+		panic("kfree: %08x was not returned by kmalloc", p);
+	pp->pp_flags &= ~PP_KMALLOC;
+	page_free_order(pp, pp->pp_order);
+}
+
+void
+kmem_init(void)
+{
+	int i;
+
+	kmem_cache_setup(&kmem_cache_cache, "kmem_cache",
+			 sizeof(struct KmemCache), sizeof(void *), NULL);
+
+	// A power-of-two object aligned to its own size never straddles
+	// a cache line, so no class needs padding beyond that.
+	for (i = 0; i < NKMALLOC; i++)
+		if (!(kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i],
+				KMALLOC_MIN << i, KMALLOC_MIN << i, NULL)))
+			panic("kmem_init: out of memory");
+
+	check_kmem();
+}
+
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+#define CHECK_MAGIC	0x51ab51ab
+
+struct CheckObj {
+	struct CheckObj *co_next;
+	uint32_t co_magic;		// set by the constructor only
+	char co_pad[52];
+};
+
+static int check_ctor_calls;
+
+static void
+check_ctor(void *obj)
+{
+	((struct CheckObj *) obj)->co_magic = CHECK_MAGIC;
+	check_ctor_calls++;
+}
+
+static void
+check_kmem(void)
+{
+	static const size_t sizes[] = {
+		1, 31, 32, 33, 100, 1024, 2047, 2048, 2049, 3 * PGSIZE + 1,
+	};
+	struct KmemCache *kc;
+	struct CheckObj *co, *list = NULL;
+	size_t size, cls;
+	char *p;
+	int i, n;
+
+	assert(KMALLOC_MIN << (NKMALLOC - 1) == KMALLOC_MAX);
+
+	// Objects and the header fill at least seven eighths of every
+	// kmalloc slab, alignment padding notwithstanding.
+	for (i = 0; i < NKMALLOC; i++) {
+		kc = kmalloc_caches[i];
+		size = kc->kc_perslab * (kc->kc_size + sizeof(uint16_t))
+			+ sizeof(struct Slab);
+		assert(size * 8 >= (PGSIZE << kc->kc_order) * 7);
+	}
+
+	kc = kmem_cache_create("check", sizeof(struct CheckObj), 0, check_ctor);
+	assert(kc);
+	assert(kc->kc_align == dcache_line_size());
+	assert(kc->kc_perslab > 1);
+
+	// Fill three slabs and a bit; objects are constructed, aligned
+	// and distinct.
+	n = 3 * kc->kc_perslab + 1;
+	for (i = 0; i < n; i++) {
+		assert((co = kmem_cache_alloc(kc)));
+		assert(co->co_magic == CHECK_MAGIC);
+		assert((uintptr_t) co % kc->kc_align == 0);
+		co->co_next = list;
+		list = co;
+	}
+	assert(kc->kc_inuse == n && kc->kc_nslabs == 4);
+	assert(check_ctor_calls == 4 * kc->kc_perslab);
+	for (co = list; co; co = co->co_next)
+		assert(co->co_next != co && co->co_magic == CHECK_MAGIC);
+
+	// Free them; objects keep their constructed state and only one
+	// empty slab stays around.
+	while ((co = list) != NULL) {
+		list = co->co_next;
+		kmem_cache_free(kc, co);
+	}
+	assert(kc->kc_inuse == 0 && kc->kc_nslabs == 1);
+	assert(kc->kc_partial == NULL && kc->kc_full == NULL && kc->kc_empty);
+
+	// Reallocation reuses the cached slab without constructing again.
+	n = check_ctor_calls;
+	assert((co = kmem_cache_alloc(kc)) && co->co_magic == CHECK_MAGIC);
+	assert(check_ctor_calls == n && kc->kc_nslabs == 1);
+	kmem_cache_free(kc, co);
+	kmem_cache_destroy(kc);
+	for (kc = kmem_caches; kc; kc = kc->kc_next)
+		assert(strcmp(kc->kc_name, "check") != 0);
+
+	// kmalloc, through every size class and the page path.
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		size = sizes[i];
+		assert((p = kmalloc(size)));
+		for (cls = KMALLOC_MIN; cls < size; cls <<= 1)
+			;
+		if (size <= KMALLOC_MAX)
+			assert((uintptr_t) p % MIN(cls, dcache_line_size()) == 0);
+		else
+			assert(PGOFF(p) == 0);
+		memset(p, 0xa5, size);
+		kfree(p);
+	}
+	assert(kmalloc(0) == NULL);
+	kfree(NULL);
+
+	cprintf("check_kmem() succeeded!\n");
+}
@@ -0,0 +1,59 @@
+#ifndef JOS_KERN_SLAB_H
+#define JOS_KERN_SLAB_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Slab;
+
+// An object cache.  Objects live in slabs of 2^kc_order pages taken
+// from the buddy allocator; each slab starts with a struct Slab header
+// followed by its free-index array and then the objects themselves.
+struct KmemCache {
+	const char *kc_name;
+	size_t kc_objsize;		// size the creator asked for
+	size_t kc_size;			// object stride, a multiple of kc_align
+	size_t kc_align;
+	uint32_t kc_reciprocal;		// ceil(2^32 / kc_size), to index objects
+	int kc_order;			// slab size is PGSIZE << kc_order
+	int kc_perslab;			// objects per slab
+	size_t kc_offset;		// offset of the first object in a slab
+	size_t kc_color_max;		// largest slab color (spare bytes)
+	size_t kc_color_next;		// color the next new slab gets
+	void (*kc_ctor)(void *obj);	// run once per object when a slab is made
+
+	struct Slab *kc_partial;	// slabs with some objects free
+	struct Slab *kc_full;		// slabs with no objects free
+	struct Slab *kc_empty;		// at most one slab with every object free
+
+	uint32_t kc_nslabs;		// slabs currently owned
+	uint32_t kc_inuse;		// objects currently allocated
+	uint32_t kc_nalloc;		// kmem_cache_alloc calls that succeeded
+	uint32_t kc_nfree;		// kmem_cache_free calls
+
+	struct KmemCache *kc_next;	// link on kmem_caches
+};
+
+// Every cache, newest first.
+extern struct KmemCache *kmem_caches;
+
+void	kmem_init(void);
+
+struct KmemCache *kmem_cache_create(const char *name, size_t size,
+				    size_t align, void (*ctor)(void *));
+void	kmem_cache_destroy(struct KmemCache *kc);
+void	*kmem_cache_alloc(struct KmemCache *kc);
+void	kmem_cache_free(struct KmemCache *kc, void *obj);
+
+// General-purpose allocation.  Requests up to KMALLOC_MAX bytes come
+// from power-of-two caches aligned to the data cache line; larger ones
+// are whole buddy blocks.
+#define KMALLOC_MIN	32
+#define KMALLOC_MAX	2048
+
+void	*kmalloc(size_t size);
+void	kfree(void *p);
+
+#endif	// !JOS_KERN_SLAB_H
@@ -0,0 +1,320 @@
+// Timekeeping, one-shot deadlines and the cycle counter.
+//
+// time_ns() reads whichever free-running counter the CPU has: the
+// ARMv7 generic timer when there is one (the Cortex-A7 of a real
+// Raspberry Pi 2), otherwise the 1MHz counter of the BCM2835 system
+// timer (the ARM1176 QEMU emulates).  Counts turn into nanoseconds
+// with a multiply and a shift chosen at boot, so reading the time
+// takes no lock and divides nothing.
+//
+// Deadlines always use compare channel 1 of the system timer, which
+// reaches the CPU through the BCM2835 interrupt controller on either
+// core, and the periodic tick channel 3.
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/stdio.h>
+#include <inc/arm.h>
+
+#include <kern/time.h>
+#include <kern/pmu.h>
+#include <kern/trap.h>
+#include <kern/irq.h>
+
+enum
+{
+    ST_BASE = MMIOBASE + 0x3000,
+
+    ST_CS   = (ST_BASE + 0x00),	// match flags, write 1 to clear
+    ST_CLO  = (ST_BASE + 0x04),	// counter, low 32 bits
+    ST_CHI  = (ST_BASE + 0x08),	// counter, high 32 bits
+    ST_C1   = (ST_BASE + 0x10),	// compare 1
+    ST_C3   = (ST_BASE + 0x18),	// compare 3
+};
+
+#define ST_CS_M1	(1 << 1)
+#define ST_CS_M3	(1 << 3)
+#define ST_FREQ		1000000
+
+static inline void mmio_write(uint32_t reg, uint32_t data)
+{
+	*(volatile uint32_t *)reg = data;
+}
+
+static inline uint32_t mmio_read(uint32_t reg)
+{
+	return *(volatile uint32_t *)reg;
+}
+
+static bool use_gentimer;
+static uint32_t clock_freq;
+static uint32_t clock_mult;
+static uint32_t clock_shift;
+
+static void (*deadline_fn)(void *);
+static void *deadline_arg;
+
+static irq_handler_t tick_fn;
+static void *tick_arg;
+static uint32_t tick_us;
+
+static void check_time(void);
+
+static uint64_t
+systimer_read(void)
+{
+	uint32_t hi, lo;
+
+	// The two halves are separate reads; retry if the low half
+	// wrapped in between.
+	do {
+		hi = mmio_read(ST_CHI);
+		lo = mmio_read(ST_CLO);
+	} while (mmio_read(ST_CHI) != hi);
+	return ((uint64_t) hi << 32) | lo;
+}
+
+static uint64_t
+gentimer_read(void)
+{
+	uint32_t lo, hi;
+
+	isb();
+	asm volatile("mrrc p15, 0, %0, %1, c14" : "=r" (lo), "=r" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
+// The raw count of the clock time_ns() is based on.
+uint64_t
+time_counter(void)
+{
+	return use_gentimer ? gentimer_read() : systimer_read();
+}
+
+// Nanoseconds since the clock started.
+uint64_t
+time_ns(void)
+{
+	uint64_t cnt = time_counter();
+	uint32_t hi = cnt >> 32, lo = cnt;
+
+	// cnt * mult >> shift, in two halves so nothing overflows.
+	return (((uint64_t) hi * clock_mult) << (32 - clock_shift))
+		+ (((uint64_t) lo * clock_mult) >> clock_shift);
+}
+
+// Pick the largest shift whose multiplier still fits in 32 bits.
+static void
+clock_setup(uint32_t freq)
+{
+	uint64_t mult = 0;
+	int shift;
+
+	for (shift = 32; shift > 0; shift--)
+		if ((mult = (NSEC_PER_SEC << shift) / freq) <= 0xFFFFFFFF)
+			break;
+	clock_freq = freq;
+	clock_mult = mult;
+	clock_shift = shift;
+}
+
+static void
+clock_init(void)
+{
+	uint32_t pfr1, freq = 0;
+
+	asm volatile("mrc p15, 0, %0, c0, c1, 1" : "=r" (pfr1));
+	if ((pfr1 >> 16) & 0xF)
+		asm volatile("mrc p15, 0, %0, c14, c0, 0" : "=r" (freq));
+	// Boot firmware that leaves CNTFRQ unset leaves us guessing.
+	use_gentimer = freq != 0;
+	clock_setup(use_gentimer ? freq : ST_FREQ);
+}
+
+static void
+deadline_intr(struct Trapframe *tf, void *arg)
+{
+	void (*fn)(void *) = deadline_fn;
+
+	irq_disable(IRQ_TIMER1);
+	mmio_write(ST_CS, ST_CS_M1);
+	deadline_fn = NULL;
+	if (fn)
+		fn(deadline_arg);
+}
+
+// Call fn(arg) from the timer interrupt once time_ns() reaches
+// 'deadline', replacing any deadline still pending.  Resolution is a
+// microsecond; a deadline already past fires right away.  Returns
+// -E_INVAL if the deadline is more than half the 32-bit compare range
+// (about 35 minutes) away.
+int
+time_set_deadline(uint64_t deadline, void (*fn)(void *), void *arg)
+{
+	int64_t delta = deadline - time_ns();
+	uint32_t us;
+
+	if (delta >= (int64_t) 0x7FFFFFFF * NSEC_PER_USEC)
+		return -E_INVAL;
+	us = delta > 0 ? (delta + NSEC_PER_USEC - 1) / NSEC_PER_USEC : 0;
+	// The counter has to pass the compare value after it is written.
+	us = MAX(us, 2);
+
+	irq_disable(IRQ_TIMER1);
+	deadline_fn = fn;
+	deadline_arg = arg;
+	mmio_write(ST_CS, ST_CS_M1);
+	mmio_write(ST_C1, mmio_read(ST_CLO) + us);
+	irq_enable(IRQ_TIMER1);
+	return 0;
+}
+
+void
+time_cancel_deadline(void)
+{
+	irq_disable(IRQ_TIMER1);
+	mmio_write(ST_CS, ST_CS_M1);
+	deadline_fn = NULL;
+}
+
+static void
+tick_intr(struct Trapframe *tf, void *arg)
+{
+	uint32_t next;
+
+	mmio_write(ST_CS, ST_CS_M3);
+	// Count from the last compare value, not from now, so that the
+	// period does not drift; but if ticks were missed, skip them.
+	next = mmio_read(ST_C3) + tick_us;
+	if ((int32_t) (next - mmio_read(ST_CLO)) < 2)
+		next = mmio_read(ST_CLO) + tick_us;
+	mmio_write(ST_C3, next);
+	if (tick_fn)
+		tick_fn(tf, tick_arg);
+}
+
+// Call fn(tf, arg) from the timer interrupt every 'period'
+// nanoseconds, with the trapframe of the code it interrupted, until
+// time_stop_periodic().  Resolution is a microsecond.  Returns
+// -E_INVAL for periods below 10us, which would leave no time for
+// anything else, or above about 35 minutes.
+int
+time_start_periodic(uint64_t period, irq_handler_t fn, void *arg)
+{
+	uint64_t us = period / NSEC_PER_USEC;
+
+	if (us < 10 || us > 0x7FFFFFFF)
+		return -E_INVAL;
+
+	irq_disable(IRQ_TIMER3);
+	tick_fn = fn;
+	tick_arg = arg;
+	tick_us = us;
+	mmio_write(ST_CS, ST_CS_M3);
+	mmio_write(ST_C3, mmio_read(ST_CLO) + tick_us);
+	irq_enable(IRQ_TIMER3);
+	return 0;
+}
+
+void
+time_stop_periodic(void)
+{
+	irq_disable(IRQ_TIMER3);
+	mmio_write(ST_CS, ST_CS_M3);
+	tick_fn = NULL;
+}
+
+void
+time_init(void)
+{
+	clock_init();
+	pmu_init();
+	irq_register(IRQ_TIMER1, deadline_intr, NULL);
+	irq_disable(IRQ_TIMER1);
+	irq_register(IRQ_TIMER3, tick_intr, NULL);
+	irq_disable(IRQ_TIMER3);
+
+	cprintf("time: %s at %u Hz, %s cycle counter\n",
+		use_gentimer ? "generic timer" : "system timer", clock_freq,
+		pmu_model == PMU_V7 ? "PMCCNTR" :
+		pmu_model == PMU_V6 ? "CCNT" : "no");
+	check_time();
+}
+
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+static volatile uint64_t check_fired_at;
+
+static void
+check_deadline(void *arg)
+{
+	check_fired_at = time_ns();
+}
+
+static volatile int check_ticks;
+
+static void
+check_tick(struct Trapframe *tf, void *arg)
+{
+	check_ticks++;
+}
+
+static void
+check_time(void)
+{
+	uint64_t t0, t1;
+	uint32_t c0;
+
+	// The clock moves forward, and the cycle counter with it.
+	c0 = cycles();
+	t0 = time_ns();
+	while ((t1 = time_ns()) - t0 < 100 * NSEC_PER_USEC)
+		;
+	assert(t1 > t0);
+	assert(cycles() != c0);
+
+	// A deadline fires once, and not early.
+	check_fired_at = 0;
+	t0 = time_ns();
+	assert(time_set_deadline(t0 + 500 * NSEC_PER_USEC, check_deadline, NULL) == 0);
+	intr_enable();
+	while (!check_fired_at && time_ns() - t0 < 100000 * NSEC_PER_USEC)
+		;
+	intr_disable();
+	assert(check_fired_at && check_fired_at - t0 >= 500 * NSEC_PER_USEC);
+
+	// A cancelled one does not.
+	check_fired_at = 0;
+	t0 = time_ns();
+	assert(time_set_deadline(t0 + 200 * NSEC_PER_USEC, check_deadline, NULL) == 0);
+	time_cancel_deadline();
+	intr_enable();
+	while (time_ns() - t0 < 1000 * NSEC_PER_USEC)
+		;
+	intr_disable();
+	assert(!check_fired_at);
+
+	assert(time_set_deadline(time_ns() + 3600 * NSEC_PER_SEC, check_deadline, NULL) == -E_INVAL);
+
+	// A periodic tick keeps firing until stopped, and then stops.
+	check_ticks = 0;
+	t0 = time_ns();
+	assert(time_start_periodic(200 * NSEC_PER_USEC, check_tick, NULL) == 0);
+	intr_enable();
+	while (time_ns() - t0 < 2000 * NSEC_PER_USEC)
+		;
+	time_stop_periodic();
+	c0 = check_ticks;
+	while (time_ns() - t0 < 3000 * NSEC_PER_USEC)
+		;
+	intr_disable();
+	assert(c0 >= 5 && c0 <= 11 && check_ticks == c0);
+	assert(time_start_periodic(NSEC_PER_USEC, check_tick, NULL) == -E_INVAL);
+
+	cprintf("check_time() succeeded!\n");
+}
@@ -0,0 +1,39 @@
+#ifndef JOS_KERN_TIME_H
+#define JOS_KERN_TIME_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+#include <kern/irq.h>
+#include <kern/pmu.h>
+
+#define NSEC_PER_USEC	1000ULL
+#define NSEC_PER_SEC	1000000000ULL
+
+void	time_init(void);
+uint64_t time_counter(void);
+uint64_t time_ns(void);
+int	time_set_deadline(uint64_t deadline, void (*fn)(void *), void *arg);
+void	time_cancel_deadline(void);
+int	time_start_periodic(uint64_t period, irq_handler_t fn, void *arg);
+void	time_stop_periodic(void);
+
+// Cycles elapsed, modulo 2^32; only differences mean anything.  Costs
+// one coprocessor read, so it is fine for hot-path instrumentation.
+static inline uint32_t
+cycles(void)
+{
+	uint32_t val;
+
+	if (pmu_model == PMU_V7)
+		asm volatile("mrc p15, 0, %0, c9, c13, 0" : "=r" (val));
+	else if (pmu_model == PMU_V6)
+		asm volatile("mrc p15, 0, %0, c15, c12, 1" : "=r" (val));
+	else
+		val = time_counter();
+	return val;
+}
+
+#endif	// !JOS_KERN_TIME_H
@@ -0,0 +1,191 @@
+#include <inc/types.h>
+#include <inc/mmu.h>
+#include <inc/arm.h>
+#include <inc/assert.h>
+#include <inc/stdio.h>
+
+#include <kern/trap.h>
+#include <kern/irq.h>
+#include <kern/monitor.h>
+#include <kern/vm.h>
+#include <kern/pmu.h>
+
+// Stacks of the exception modes other than SVC, which keeps using the
+// kernel stack.  Each must hold a Trapframe plus the C handler.
+#define TRAPSTKSIZE	(2 * PGSIZE)
+
+static const uint32_t trapmodes[] = { PSR_IRQ, PSR_ABT, PSR_UND, PSR_FIQ };
+#define NTRAPMODES	(sizeof(trapmodes) / sizeof(trapmodes[0]))
+
+static uint8_t trapstacks[NTRAPMODES][TRAPSTKSIZE]
+	__attribute__((aligned(8)));
+
+// Set by kernel code about to touch a register that might not exist.
+// An undefined instruction then skips the instruction and clears
+// trap_probe instead of panicking.
+volatile int trap_probe;
+
+static const char *
+trapname(int trapno)
+{
+	static const char * const excnames[] = {
+		"Reset",
+		"Undefined Instruction",
+		"Supervisor Call",
+		"Prefetch Abort",
+		"Data Abort",
+		"Reserved",
+		"IRQ",
+		"FIQ",
+	};
+
+	if (trapno >= 0 && trapno < sizeof(excnames)/sizeof(excnames[0]))
+		return excnames[trapno];
+	return "(unknown trap)";
+}
+
+const char *
+fault_name(uint32_t fsr)
+{
+	switch (FSR_FS(fsr)) {
+	case FS_ALIGN:		return "alignment fault";
+	case FS_DEBUG:		return "debug event";
+	case FS_ACCESS_SEC:	return "section access flag fault";
+	case FS_ICACHE:		return "icache maintenance fault";
+	case FS_TRANS_SEC:	return "section translation fault";
+	case FS_ACCESS_PAGE:	return "page access flag fault";
+	case FS_TRANS_PAGE:	return "page translation fault";
+	case FS_EXT:		return "external abort";
+	case FS_DOMAIN_SEC:	return "section domain fault";
+	case FS_DOMAIN_PAGE:	return "page domain fault";
+	case FS_WALK_L1:	return "external abort on L1 walk";
+	case FS_PERM_SEC:	return "section permission fault";
+	case FS_WALK_L2:	return "external abort on L2 walk";
+	case FS_PERM_PAGE:	return "page permission fault";
+	case FS_IMPRECISE:	return "imprecise external abort";
+	}
+	return "unknown fault";
+}
+
+static const char *
+modename(uint32_t psr)
+{
+	switch (psr & PSR_MODE_MASK) {
+	case PSR_USR:	return "usr";
+	case PSR_FIQ:	return "fiq";
+	case PSR_IRQ:	return "irq";
+	case PSR_SVC:	return "svc";
+	case PSR_ABT:	return "abt";
+	case PSR_UND:	return "und";
+	case PSR_SYS:	return "sys";
+	}
+	return "???";
+}
+
+// Point each exception mode's banked sp at its stack, then route
+// exceptions to the table in kern/trapentry.S.
+void
+trap_init(void)
+{
+	extern char vectors[];
+	uint32_t i, cpsr;
+
+	for (i = 0; i < NTRAPMODES; i++) {
+		asm volatile("mrs %0, cpsr\n"
+			     "msr cpsr_c, %1\n"
+			     "mov sp, %2\n"
+			     "msr cpsr_c, %0\n"
+			     : "=&r" (cpsr)
+			     : "r" (trapmodes[i] | PSR_I | PSR_F),
+			       "r" (trapstacks[i] + TRAPSTKSIZE)
+			     : "memory");
+	}
+
+	write_vbar((uint32_t) vectors);
+	write_sctlr(read_sctlr() & ~SCTLR_V);
+	isb();
+
+	irq_init();
+}
+
+void
+print_trapframe(struct Trapframe *tf)
+{
+	int i;
+
+	cprintf("TRAP frame at %p\n", tf);
+	for (i = 0; i < 13; i++)
+		cprintf("  r%d%s 0x%08x%s", i, i < 10 ? " " : "",
+			tf->tf_r[i], i % 4 == 3 ? "\n" : "");
+	cprintf("\n");
+	cprintf("  sp  0x%08x  lr  0x%08x  pc  0x%08x\n",
+		tf->tf_sp, tf->tf_lr, tf->tf_pc);
+	cprintf("  spsr 0x%08x [%s%s%s%s]\n", tf->tf_spsr,
+		modename(tf->tf_spsr),
+		tf->tf_spsr & PSR_T ? " T" : "",
+		tf->tf_spsr & PSR_I ? " I" : "",
+		tf->tf_spsr & PSR_F ? " F" : "");
+	cprintf("  trap 0x%08x %s\n", tf->tf_trapno, trapname(tf->tf_trapno));
+}
+
+void
+data_abort_handler(struct Trapframe *tf)
+{
+	uint32_t fsr = read_dfsr();
+	uintptr_t va = read_dfar();
+	int r;
+
+	// Pages reserved in the running address space fill in on demand.
+	PMU_REGION_BEGIN("vm_fault");
+	r = vm_fault(curas, va, fsr);
+	PMU_REGION_END("vm_fault");
+	if (r == 0)
+		return;
+
+	print_trapframe(tf);
+	panic("data abort: %s %s va %08x, domain %d, pc %08x",
+	      fault_name(fsr), (fsr & FSR_WNR) ? "writing" : "reading",
+	      va, FSR_DOMAIN(fsr), tf->tf_pc);
+}
+
+void
+prefetch_abort_handler(struct Trapframe *tf)
+{
+	uint32_t fsr = read_ifsr();
+	uintptr_t va = read_ifar();
+
+	print_trapframe(tf);
+	panic("prefetch abort: %s at va %08x", fault_name(fsr), va);
+}
+
+void
+trap(struct Trapframe *tf)
+{
+	switch (tf->tf_trapno) {
+	case T_DABT:
+		data_abort_handler(tf);
+		return;
+	case T_PABT:
+		prefetch_abort_handler(tf);
+		return;
+	case T_IRQ:
+		irq_dispatch(tf);
+		return;
+	case T_UNDEF:
+		if (trap_probe && (tf->tf_spsr & PSR_MODE_MASK) != PSR_USR) {
+			trap_probe = 0;
+			tf->tf_pc += 4;
+			return;
+		}
+		break;
+	case T_SVC:
+		// There are no system calls yet, so an SVC works as a
+		// breakpoint: look around in the monitor, then resume.
+		print_trapframe(tf);
+		monitor(tf);
+		return;
+	}
+
+	print_trapframe(tf);
+	panic("unhandled trap in %s mode", modename(tf->tf_spsr));
+}
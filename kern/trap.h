@@ -0,0 +1,21 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TRAP_H
+#define JOS_KERN_TRAP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/trap.h>
+#include <inc/mmu.h>
+
+extern volatile int trap_probe;
+
+void trap_init(void);
+void trap(struct Trapframe *tf);
+void print_trapframe(struct Trapframe *tf);
+void data_abort_handler(struct Trapframe *tf);
+void prefetch_abort_handler(struct Trapframe *tf);
+const char *fault_name(uint32_t fsr);
+
+#endif /* JOS_KERN_TRAP_H */
@@ -0,0 +1,313 @@
+// User address spaces and demand paging.
+//
+// An address space reserves regions of user addresses without backing
+// them.  The data abort handler calls vm_fault(), which fills in one
+// page at a time: reads get the shared zero page, mapped read-only,
+// and writes get a newly zeroed page of their own.  A sparse heap or
+// stack then only costs the pages actually written.
+//
+// Pages can also be shared copy-on-write (PTE_COW): as_dup() copies an
+// address space that way, and the zero page is mapped that way into
+// writable regions.  A store to such a page faults, and the writer gets
+// a copy unless nobody else maps the page any more, in which case it
+// is simply made writable again.
+
+#include <inc/types.h>
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/stdio.h>
+#include <inc/mmu.h>
+
+#include <kern/pmap.h>
+#include <kern/slab.h>
+#include <kern/vm.h>
+
+struct AddrSpace *curas;
+
+static struct KmemCache *as_cache;
+static struct KmemCache *region_cache;
+static struct PageInfo *zero_page;
+
+static void check_vm(void);
+
+void
+vm_init(void)
+{
+	as_cache = kmem_cache_create("addrspace", sizeof(struct AddrSpace),
+				     0, NULL);
+	region_cache = kmem_cache_create("vmregion", sizeof(struct VmRegion),
+					 0, NULL);
+	if (!as_cache || !region_cache)
+		panic("vm_init: out of memory");
+
+	// The zero page holds a reference of its own and is never freed.
+	if (!(zero_page = page_alloc(ALLOC_ZERO)))
+		panic("vm_init: out of memory");
+	zero_page->pp_ref++;
+
+	check_vm();
+}
+
+struct AddrSpace *
+as_create(void)
+{
+	struct AddrSpace *as;
+
+	if (!(as = kmem_cache_alloc(as_cache)))
+		return NULL;
+	if (!(as->as_pgdir = pgdir_create())) {
+		kmem_cache_free(as_cache, as);
+		return NULL;
+	}
+	as->as_regions = NULL;
+	return as;
+}
+
+void
+as_destroy(struct AddrSpace *as)
+{
+	struct VmRegion *vr;
+
+	if (as == curas)
+		as_switch(NULL);
+	pgdir_destroy(as->as_pgdir);
+	while ((vr = as->as_regions) != NULL) {
+		as->as_regions = vr->vr_next;
+		kmem_cache_free(region_cache, vr);
+	}
+	kmem_cache_free(as_cache, as);
+}
+
+// A copy of 'src' that shares every page with it copy-on-write, or
+// NULL if out of memory.
+struct AddrSpace *
+as_dup(struct AddrSpace *src)
+{
+	struct AddrSpace *as;
+	struct VmRegion *vr, *nvr, **tail;
+
+	if (!(as = kmem_cache_alloc(as_cache)))
+		return NULL;
+	as->as_regions = NULL;
+	if (!(as->as_pgdir = pgdir_dup(src->as_pgdir))) {
+		kmem_cache_free(as_cache, as);
+		return NULL;
+	}
+	tail = &as->as_regions;
+	for (vr = src->as_regions; vr; vr = vr->vr_next) {
+		if (!(nvr = kmem_cache_alloc(region_cache))) {
+			as_destroy(as);
+			return NULL;
+		}
+		*nvr = *vr;
+		nvr->vr_next = NULL;
+		*tail = nvr;
+		tail = &nvr->vr_next;
+	}
+	return as;
+}
+
+// Run with 'as' as the user half of the address space, or with none.
+void
+as_switch(struct AddrSpace *as)
+{
+	pgdir_switch(as ? as->as_pgdir : kern_pgdir);
+	curas = as;
+}
+
+// Reserve [va, va+len) for demand-zero pages with permission 'perm'.
+// Returns -E_INVAL if the range is misaligned, reaches USERTOP or
+// overlaps an existing region.
+int
+as_reserve(struct AddrSpace *as, uintptr_t va, size_t len, int perm)
+{
+	struct VmRegion *vr, **prev;
+	uintptr_t end = va + len;
+
+	if (PGOFF(va) || PGOFF(len) || len == 0 || end <= va || end > USERTOP)
+		return -E_INVAL;
+	if (perm != PTE_R_U && perm != PTE_RW_U)
+		return -E_INVAL;
+	for (prev = &as->as_regions; *prev; prev = &(*prev)->vr_next) {
+		if ((*prev)->vr_start >= end)
+			break;
+		if ((*prev)->vr_end > va)
+			return -E_INVAL;
+	}
+
+	if (!(vr = kmem_cache_alloc(region_cache)))
+		return -E_NO_MEM;
+	vr->vr_start = va;
+	vr->vr_end = end;
+	vr->vr_perm = perm;
+	vr->vr_next = *prev;
+	*prev = vr;
+	return 0;
+}
+
+// The region of 'as' containing 'va', or NULL.
+struct VmRegion *
+as_find(struct AddrSpace *as, uintptr_t va)
+{
+	struct VmRegion *vr;
+
+	for (vr = as->as_regions; vr && vr->vr_start <= va; vr = vr->vr_next)
+		if (va < vr->vr_end)
+			return vr;
+	return NULL;
+}
+
+// Give the writer of the copy-on-write page 'pp' at 'va' a page of its
+// own, which is 'pp' itself once nothing else maps it.
+static int
+cow_break(pde_t *pgdir, struct PageInfo *pp, uintptr_t va)
+{
+	struct PageInfo *npp;
+	int r;
+
+	if (pp->pp_ref == 1)
+		return page_insert(pgdir, pp, (void *) va, PTE_RW_U);
+
+	if (!(npp = page_alloc(pp == zero_page ? ALLOC_ZERO : 0)))
+		return -E_NO_MEM;
+	if (pp != zero_page)
+		page_copy(page2kva(npp), page2kva(pp));
+	if ((r = page_insert(pgdir, npp, (void *) va, PTE_RW_U)) < 0) {
+		page_free(npp);
+		return r;
+	}
+	return 0;
+}
+
+// Resolve a data abort at 'va' with status 'fsr' in address space 'as'.
+// Returns 0 if the access can be retried, or -E_FAULT if it was neither
+// to a reserved page not yet populated nor a store to a copy-on-write
+// page.
+int
+vm_fault(struct AddrSpace *as, uintptr_t va, uint32_t fsr)
+{
+	struct VmRegion *vr;
+	struct PageInfo *pp;
+	bool write = fsr & FSR_WNR;
+	pte_t *pte;
+	int r;
+
+	if (!as || va >= USERTOP)
+		return -E_FAULT;
+	va = ROUNDDOWN(va, PGSIZE);
+
+	switch (FSR_FS(fsr)) {
+	case FS_PERM_PAGE:
+		// Large pages are never copy-on-write.
+		pp = page_lookup(as->as_pgdir, (void *) va, &pte);
+		if (!write || !pp || !(*pte & PTE_ENTRY_SMALL)
+		    || (*pte & PTE_COW) != PTE_COW)
+			return -E_FAULT;
+		return cow_break(as->as_pgdir, pp, va);
+
+	case FS_TRANS_SEC:
+	case FS_TRANS_PAGE:
+		if (!(vr = as_find(as, va)))
+			return -E_FAULT;
+		if (vr->vr_perm != PTE_RW_U) {
+			if (write)
+				return -E_FAULT;
+			return page_insert(as->as_pgdir, zero_page, (void *) va,
+					   PTE_APX | PTE_R_U);
+		}
+		if (!write)
+			return page_insert(as->as_pgdir, zero_page, (void *) va,
+					   PTE_COW);
+		if (!(pp = page_alloc(ALLOC_ZERO)))
+			return -E_NO_MEM;
+		if ((r = page_insert(as->as_pgdir, pp, (void *) va, PTE_RW_U)) < 0) {
+			page_free(pp);
+			return r;
+		}
+		return 0;
+	}
+	return -E_FAULT;
+}
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+static void
+check_vm(void)
+{
+	struct AddrSpace *as, *child;
+	struct PageInfo *pp, *npp;
+	volatile uint32_t *heap, *ro;
+	int zref, i;
+
+	assert((as = as_create()));
+	assert(as_reserve(as, 0x10000000, 4 * PTSIZE, PTE_RW_U) == 0);
+	assert(as_reserve(as, 0x20000000, PGSIZE, PTE_R_U) == 0);
+	assert(as_reserve(as, 0x10000000 + PTSIZE, PGSIZE, PTE_RW_U) == -E_INVAL);
+	assert(as_reserve(as, 0x0FFFF000, 2 * PGSIZE, PTE_RW_U) == -E_INVAL);
+	assert(as_reserve(as, USERTOP - PGSIZE, 2 * PGSIZE, PTE_RW_U) == -E_INVAL);
+	assert(as_reserve(as, 0x30000000, 100, PTE_RW_U) == -E_INVAL);
+	assert(as_find(as, 0x10000000 + 4 * PTSIZE - 1));
+	assert(!as_find(as, 0x10000000 + 4 * PTSIZE));
+	as_switch(as);
+
+	// Reads across a sparse 4MB heap all share the zero page.
+	heap = (volatile uint32_t *) 0x10000000;
+	zref = zero_page->pp_ref;
+	for (i = 0; i < 4; i++)
+		assert(heap[i * PTSIZE / sizeof(uint32_t)] == 0);
+	assert(zero_page->pp_ref == zref + 4);
+	assert(page_lookup(as->as_pgdir, (void *) heap, NULL) == zero_page);
+
+	// A write to a page already reading as zero gets a page of its
+	// own; a write to an untouched page goes straight there.
+	heap[1] = 0x1234;
+	assert((pp = page_lookup(as->as_pgdir, (void *) heap, NULL)));
+	assert(pp != zero_page && pp->pp_ref == 1);
+	assert(zero_page->pp_ref == zref + 3);
+	assert(heap[0] == 0 && heap[1] == 0x1234);
+	heap[PGSIZE] = 7;
+	assert(heap[PGSIZE] == 7 && heap[PGSIZE + 1] == 0);
+	assert(zero_page->pp_ref == zref + 3);
+	assert(((uint32_t *) page2kva(zero_page))[1] == 0);
+
+	// A read-only region reads as zero.
+	ro = (volatile uint32_t *) 0x20000000;
+	assert(ro[10] == 0);
+	assert(vm_fault(as, 0x20000000, FSR_WNR | FS_PERM_PAGE) == -E_FAULT);
+	assert(vm_fault(as, 0x30000000, FS_TRANS_PAGE) == -E_FAULT);
+
+	// Duplicate: the pages are shared, and a store breaks the share
+	// only for the address space doing it.
+	assert((child = as_dup(as)));
+	assert(pp->pp_ref == 2);
+	assert(page_lookup(child->as_pgdir, (void *) heap, NULL) == pp);
+	assert(zero_page->pp_ref == zref + 8);
+	heap[1] = 5;
+	assert((npp = page_lookup(as->as_pgdir, (void *) heap, NULL)) != pp);
+	assert(pp->pp_ref == 1 && npp->pp_ref == 1);
+	assert(heap[1] == 5 && ((uint32_t *) page2kva(pp))[1] == 0x1234);
+	assert(heap[PGSIZE] == 7);
+
+	// The child is now the page's last owner, so its store reuses it.
+	as_switch(child);
+	assert(heap[1] == 0x1234);
+	heap[1] = 6;
+	assert(page_lookup(child->as_pgdir, (void *) heap, NULL) == pp);
+	assert(pp->pp_ref == 1 && heap[1] == 6);
+	// And storing over a shared zero page gets a zeroed page.
+	heap[PTSIZE / sizeof(uint32_t) + 2] = 9;
+	assert(heap[PTSIZE / sizeof(uint32_t)] == 0);
+	assert(zero_page->pp_ref == zref + 7);
+	as_switch(as);
+	assert(heap[1] == 5 && heap[PTSIZE / sizeof(uint32_t) + 2] == 0);
+
+	as_destroy(child);
+	as_destroy(as);
+	assert(curas == NULL);
+	assert(zero_page->pp_ref == zref);
+
+	cprintf("check_vm() succeeded!\n");
+}
@@ -0,0 +1,40 @@
+#ifndef JOS_KERN_VM_H
+#define JOS_KERN_VM_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+
+// A range of user addresses reserved in an address space.  Nothing
+// backs it until it is touched: the first read of a page maps the
+// shared zero page, the first write a fresh zeroed page.
+struct VmRegion {
+	uintptr_t vr_start;		// page aligned
+	uintptr_t vr_end;		// exclusive, page aligned
+	int vr_perm;			// PTE_R_U or PTE_RW_U
+	struct VmRegion *vr_next;	// sorted by address
+};
+
+// A user address space: the TTBR0 half and what is reserved in it.
+struct AddrSpace {
+	pde_t *as_pgdir;
+	struct VmRegion *as_regions;
+};
+
+// The running address space, or NULL for none.
+extern struct AddrSpace *curas;
+
+void	vm_init(void);
+
+struct AddrSpace *as_create(void);
+struct AddrSpace *as_dup(struct AddrSpace *src);
+void	as_destroy(struct AddrSpace *as);
+void	as_switch(struct AddrSpace *as);
+int	as_reserve(struct AddrSpace *as, uintptr_t va, size_t len, int perm);
+struct VmRegion *as_find(struct AddrSpace *as, uintptr_t va);
+
+int	vm_fault(struct AddrSpace *as, uintptr_t va, uint32_t fsr);
+
+#endif	// !JOS_KERN_VM_H
@@ -28,25 +28,57 @@ static const char * const error_string[MAXERROR] =
 	[E_FAULT]	= "segmentation fault",
 };
 
+// n / 10 by multiplying with 2^35 / 10, rounded up; exact for every
+// 32-bit n.  Cores without a divide instruction would otherwise call
+// into libgcc for each digit.
+static inline uint32_t
+udiv10(uint32_t n)
+{
+	return ((uint64_t) n * 0xCCCCCCCDU) >> 35;
+}
+
 /*
- * Print a number (base <= 16) in reverse order,
+ * Print a number (base <= 16), right-justified in 'width' with padc,
  * using specified putch function and associated pointer putdat.
+ * Digits are produced least significant first into a local buffer.
  */
 static void
 printnum(void (*putch)(int, void*), void *putdat,
 	 unsigned long long num, unsigned base, int width, int padc)
 {
-	// first recursively print all preceding (more significant) digits
-	if (num >= base) {
-		printnum(putch, putdat, num / base, base, width - 1, padc);
+	static const char digits[] = "0123456789abcdef";
+	char buf[24];		// 22 octal digits for 64 bits
+	char *p = buf + sizeof(buf);
+	uint32_t n, q;
+	int shift;
+
+	if ((base & (base - 1)) == 0) {
+		// Powers of two need only shifts and masks.
+		shift = __builtin_ctz(base);
+		do {
+			*--p = digits[num & (base - 1)];
+			num >>= shift;
+		} while (num);
 	} else {
-		// print any needed pad characters before first digit
-		while (--width > 0)
-			putch(padc, putdat);
+		// 64-bit division is a libgcc call; only use it until
+		// what is left fits in 32 bits.
+		while (num > 0xFFFFFFFFULL) {
+			*--p = digits[num % base];
+			num /= base;
+		}
+		n = num;
+		do {
+			q = (base == 10) ? udiv10(n) : n / base;
+			*--p = digits[n - q * base];
+			n = q;
+		} while (n);
 	}
 
-	// then print this (the least significant) digit
-	putch("0123456789abcdef"[num % base], putdat);
+	// print any needed pad characters before the first digit
+	for (width -= buf + sizeof(buf) - p; width > 0; width--)
+		putch(padc, putdat);
+	while (p < buf + sizeof(buf))
+		putch(*p++, putdat);
 }
 
 // Get an unsigned int of various possible sizes from a varargs list,
@@ -2,24 +2,63 @@
 
 #include <inc/string.h>
 
+// The scanning routines below read a 32-bit word at a time once their
+// pointers are word aligned.  An aligned word never straddles a page,
+// so reading past the terminating null within its word is safe.
+// Words are read little-endian: the lowest flagged byte comes first.
+
+// Lets word loads alias the char data they scan.
+typedef uint32_t __attribute__((__may_alias__)) word_t;
+
+#define ONES	0x01010101U
+#define HIGHS	0x80808080U
+
+// Nonzero if some byte of 'x' is zero.  The lowest flagged byte is
+// exactly the first zero byte; flags above it may be false positives
+// from the borrow, so only the lowest one is meaningful.
+#define HASZERO(x)	(((x) - ONES) & ~(x) & HIGHS)
+
+#define WORD_ALIGNED(p)	(((uintptr_t) (p) & 3) == 0)
+
+// Index of the byte 'zeros' (a nonzero HASZERO result) flags first.
+static inline int
+first_byte(uint32_t zeros)
+{
+	return __builtin_ctz(zeros) >> 3;
+}
+
 int
 strlen(const char *s)
 {
-	int n;
-
-	for (n = 0; *s != '\0'; s++)
-		n++;
-	return n;
+	const char *p;
+	const word_t *w;
+	uint32_t x;
+
+	for (p = s; !WORD_ALIGNED(p); p++)
+		if (*p == '\0')
+			return p - s;
+	for (w = (const word_t *) p; ; w++) {
+		x = *w;
+		if (HASZERO(x))
+			break;
+	}
+	return (const char *) w - s + first_byte(HASZERO(x));
 }
 
 int
 strnlen(const char *s, size_t size)
 {
-	int n;
-
-	for (n = 0; size > 0 && *s != '\0'; s++, size--)
-		n++;
-	return n;
+	const char *p;
+	const word_t *w;
+
+	for (p = s; size > 0 && !WORD_ALIGNED(p); p++, size--)
+		if (*p == '\0')
+			return p - s;
+	for (w = (const word_t *) p; size >= 4 && !HASZERO(*w); w++)
+		size -= 4;
+	for (p = (const char *) w; size > 0 && *p != '\0'; p++, size--)
+		/* do nothing */;
+	return p - s;
 }
 
 char *
@@ -73,6 +112,22 @@ strlcpy(char *dst, const char *src, size_t size)
 int
 strcmp(const char *p, const char *q)
 {
+	const word_t *wp, *wq;
+	uint32_t x;
+
+	// Words only help when both strings can be aligned together.
+	if (WORD_ALIGNED((uintptr_t) p ^ (uintptr_t) q)) {
+		for (; !WORD_ALIGNED(p); p++, q++)
+			if (!*p || *p != *q)
+				goto bytes;
+		wp = (const word_t *) p;
+		wq = (const word_t *) q;
+		while ((x = *wp) == *wq && !HASZERO(x))
+			wp++, wq++;
+		p = (const char *) wp;
+		q = (const char *) wq;
+	}
+bytes:
 	while (*p && *p == *q)
 		p++, q++;
 	return (int) ((unsigned char) *p - (unsigned char) *q);
@@ -94,16 +149,55 @@ strncmp(const char *p, const char *q, size_t n)
 char *
 strchr(const char *s, char c)
 {
-	for (; *s; s++)
-		if (*s == c)
-			return (char *) s;
-	return 0;
+	s = strfind(s, c);
+	return *s ? (char *) s : 0;
 }
 
 // Return a pointer to the first occurrence of 'c' in 's',
 // or a pointer to the string-ending null character if the string has no 'c'.
 char *
 strfind(const char *s, char c)
+{
+	const word_t *w;
+	uint32_t x, cc;
+
+	for (; !WORD_ALIGNED(s); s++)
+		if (!*s || *s == c)
+			return (char *) s;
+	// A byte of x ^ cc is zero where x holds 'c'.
+	cc = (unsigned char) c * ONES;
+	for (w = (const word_t *) s; ; w++) {
+		x = *w;
+		if (HASZERO(x) | HASZERO(x ^ cc))
+			break;
+	}
+	for (s = (const char *) w; *s && *s != c; s++)
+		/* do nothing */;
+	return (char *) s;
+}
+
+// Byte-at-a-time versions of the word-at-a-time routines above, kept
+// as the reference to check and measure them against.
+int
+strlen_bytes(const char *s)
+{
+	int n;
+
+	for (n = 0; *s != '\0'; s++)
+		n++;
+	return n;
+}
+
+int
+strcmp_bytes(const char *p, const char *q)
+{
+	while (*p && *p == *q)
+		p++, q++;
+	return (int) ((unsigned char) *p - (unsigned char) *q);
+}
+
+char *
+strfind_bytes(const char *s, char c)
 {
 	for (; *s; s++)
 		if (*s == c)
@@ -111,8 +205,25 @@ strfind(const char *s, char c)
 	return (char *) s;
 }
 
+int
+memcmp_bytes(const void *v1, const void *v2, size_t n)
+{
+	const uint8_t *s1 = (const uint8_t *) v1;
+	const uint8_t *s2 = (const uint8_t *) v2;
+
+	while (n-- > 0) {
+		if (*s1 != *s2)
+			return (int) *s1 - (int) *s2;
+		s1++, s2++;
+	}
+
+	return 0;
+}
+
+// Likewise for memset and memmove, which the kernel takes from
+// lib/memfunc.S.
 void *
-memset(void *v, int c, size_t n)
+memset_bytes(void *v, int c, size_t n)
 {
 	char *p;
 	int m;
@@ -126,7 +237,7 @@ memset(void *v, int c, size_t n)
 }
 
 void *
-memmove(void *dst, const void *src, size_t n)
+memmove_bytes(void *dst, const void *src, size_t n)
 {
 	const char *s;
 	char *d;
@@ -145,17 +256,25 @@ memmove(void *dst, const void *src, size_t n)
 	return dst;
 }
 
-void *
-memcpy(void *dst, const void *src, size_t n)
-{
-	return memmove(dst, src, n);
-}
-
 int
 memcmp(const void *v1, const void *v2, size_t n)
 {
 	const uint8_t *s1 = (const uint8_t *) v1;
 	const uint8_t *s2 = (const uint8_t *) v2;
+	const word_t *w1, *w2;
+
+	if (WORD_ALIGNED((uintptr_t) s1 ^ (uintptr_t) s2)) {
+		for (; n > 0 && !WORD_ALIGNED(s1); n--, s1++, s2++)
+			if (*s1 != *s2)
+				return (int) *s1 - (int) *s2;
+		// Skip equal words; the byte loop finds the difference.
+		w1 = (const word_t *) s1;
+		w2 = (const word_t *) s2;
+		for (; n >= 4 && *w1 == *w2; n -= 4)
+			w1++, w2++;
+		s1 = (const uint8_t *) w1;
+		s2 = (const uint8_t *) w2;
+	}
 
 	while (n-- > 0) {
 		if (*s1 != *s2)